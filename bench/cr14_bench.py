@@ -0,0 +1,358 @@
+#!/usr/bin/env python3
+
+"""Benchmark detection and command throughput of /dev/rfid0.
+
+Runs the benchmarks of one or more scenario files (see scenarios/) and
+writes one JSON object per result on standard output (or to --output), so
+results of kernels and boards can be compared. A human readable summary is
+written on standard error.
+
+With --sim, tags are placed on the cr14_sim emulator before each benchmark
+(requires root and debugfs).
+"""
+
+import argparse
+import json
+import os
+import platform
+import select
+import sys
+import time
+
+DEVICE = "/dev/rfid0"
+SIM_TAGS = "/sys/kernel/debug/cr14_sim/tags"
+MODEL_PATHS = (
+    "/sys/firmware/devicetree/base/model",
+    "/proc/device-tree/model",
+)
+DEFAULT_TIMEOUT = 10.0
+
+# Length of messages from the driver, after the header, given the first
+# byte following the header (count) when length depends on it.
+FIXED_LENGTHS = {"u": 8, "r": 4, "w": 4, "h": 1, "f": 1}
+BLOCKS_MESSAGES = "RWg"
+
+
+class BenchError(Exception):
+    """Raised when the device does not answer as expected."""
+
+
+def read_exact(fd, length, timeout):
+    """Read exactly length bytes, waiting at most timeout seconds."""
+    data = b""
+    deadline = time.monotonic() + timeout
+    poller = select.poll()
+    poller.register(fd, select.POLLIN)
+    while len(data) < length:
+        remaining = deadline - time.monotonic()
+        if remaining <= 0 or not poller.poll(remaining * 1000):
+            raise BenchError(f"Timeout after {timeout} s, is a tag present?")
+        data += os.read(fd, length - len(data))
+    return data
+
+
+def read_message(fd, timeout):
+    """Read a message, return its header (as a str) and its payload."""
+    header = chr(read_exact(fd, 1, timeout)[0])
+    if header in FIXED_LENGTHS:
+        return header, read_exact(fd, FIXED_LENGTHS[header], timeout)
+    if header in BLOCKS_MESSAGES:
+        count = read_exact(fd, 1, timeout)
+        return header, count + read_exact(fd, count[0] * 4, timeout)
+    if header == "U":
+        fixed = read_exact(fd, 13, timeout)
+        return header, fixed + read_exact(fd, fixed[12] * 8, timeout)
+    raise BenchError(f"Unexpected message header {header!r}")
+
+
+def wait_message(fd, expected, timeout):
+    """Read messages until one with the expected header, return payload."""
+    while True:
+        header, payload = read_message(fd, timeout)
+        if header == expected:
+            return payload
+
+
+def wait_uid(fd, timeout):
+    """Poll once and return the UID (little endian) of the first tag."""
+    os.write(fd, b"p")
+    return wait_message(fd, "u", timeout)
+
+
+def percentile(values, fraction):
+    """Return the value at fraction (0 to 1) of sorted values."""
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, int(fraction * len(ordered)))
+    return ordered[index]
+
+
+def latency_stats(latencies):
+    """Summarize latencies, in seconds, as milliseconds."""
+    return {
+        "count": len(latencies),
+        "mean_ms": 1000 * sum(latencies) / len(latencies),
+        "p50_ms": 1000 * percentile(latencies, 0.5),
+        "p99_ms": 1000 * percentile(latencies, 0.99),
+        "max_ms": 1000 * max(latencies),
+    }
+
+
+def cpu_busy_seconds():
+    """Return busy time of all CPUs (not idle nor iowait), in seconds."""
+    with open("/proc/stat", encoding="ascii") as stat:
+        fields = [int(value) for value in stat.readline().split()[1:]]
+    busy = sum(fields) - fields[3] - fields[4]
+    return busy / os.sysconf("SC_CLK_TCK")
+
+
+def sim_set_tags(count):
+    """Place count SRIX4K tags on the emulator."""
+    with open(SIM_TAGS, "w", encoding="ascii") as tags:
+        tags.write("clear\n")
+    for index in range(count):
+        with open(SIM_TAGS, "w", encoding="ascii") as tags:
+            tags.write(f"add d0020c00{index:08x}\n")
+
+
+def command_blocks(benchmark):
+    """Return the lists of blocks of a command benchmark."""
+    if "blocks" in benchmark:
+        return [benchmark["blocks"]]
+    start = benchmark.get("start", 0)
+    return [list(range(start, start + size)) for size in benchmark["sizes"]]
+
+
+def read_blocks(fd, uid, blocks, timeout):
+    """Read blocks with a single command, return their data."""
+    if len(blocks) == 1:
+        os.write(fd, b"r" + uid + bytes(blocks))
+        return [wait_message(fd, "r", timeout)]
+    os.write(fd, b"R" + uid + bytes([len(blocks)]) + bytes(blocks))
+    payload = wait_message(fd, "R", timeout)
+    return [payload[1 + 4 * ix : 5 + 4 * ix] for ix in range(payload[0])]
+
+
+def command_packet(command, uid, blocks, data):
+    """Build the packet of a command."""
+    if command == "r":
+        return b"r" + uid + bytes(blocks)
+    if command == "w":
+        return b"w" + uid + bytes(blocks) + data[0]
+    if command == "R":
+        return b"R" + uid + bytes([len(blocks)]) + bytes(blocks)
+    if command == "W":
+        return (
+            b"W" + uid + bytes([len(blocks)]) + bytes(blocks) + b"".join(data)
+        )
+    raise BenchError(f"Unsupported command {command!r}")
+
+
+def bench_first_uid(device, benchmark, timeout):
+    """Time from open (read only, poll repeat mode) to first UID."""
+    latencies = []
+    for _ in range(benchmark.get("iterations", 10)):
+        start = time.monotonic()
+        fd = os.open(device, os.O_RDONLY)
+        try:
+            wait_message(fd, "u", timeout)
+            latencies.append(time.monotonic() - start)
+        finally:
+            os.close(fd)
+    yield {"latency": latency_stats(latencies)}
+
+
+def bench_poll_once(device, benchmark, timeout):
+    """Time from poll once message to UID, on an open device."""
+    latencies = []
+    fd = os.open(device, os.O_RDWR)
+    try:
+        for _ in range(benchmark.get("iterations", 10)):
+            start = time.monotonic()
+            wait_uid(fd, timeout)
+            latencies.append(time.monotonic() - start)
+    finally:
+        os.close(fd)
+    yield {"latency": latency_stats(latencies)}
+
+
+def bench_command(device, benchmark, timeout):
+    """Latency and blocks per second of a command, for each size.
+
+    Write commands write back the data previously read, so tags are not
+    modified.
+    """
+    command = benchmark["command"]
+    iterations = benchmark.get("iterations", 20)
+    fd = os.open(device, os.O_RDWR)
+    try:
+        uid = wait_uid(fd, timeout)
+        for blocks in command_blocks(benchmark):
+            if len(blocks) > 1 and command in "rw":
+                raise BenchError(f"Command {command!r} is for one block")
+            data = None
+            if command in "wW":
+                data = read_blocks(fd, uid, blocks, timeout)
+            packet = command_packet(command, uid, blocks, data)
+            latencies = []
+            for _ in range(iterations):
+                start = time.monotonic()
+                os.write(fd, packet)
+                wait_message(fd, command, timeout)
+                latencies.append(time.monotonic() - start)
+            yield {
+                "blocks": len(blocks),
+                "blocks_per_s": len(blocks) * iterations / sum(latencies),
+                "latency": latency_stats(latencies),
+            }
+    finally:
+        os.close(fd)
+
+
+def measure_rounds(device, duration, timeout):
+    """Collect round summaries for duration seconds.
+
+    Return durations of rounds by number of tags (from round start to
+    summary reception) and CPU busy time per round.
+    """
+    durations = {}
+    rounds = 0
+    fd = os.open(device, os.O_RDWR)
+    try:
+        # The driver consumes one packet per write.
+        os.write(fd, b"U\x01")
+        os.write(fd, b"P")
+        # Skip the round that was running.
+        wait_message(fd, "U", timeout)
+        cpu_start = cpu_busy_seconds()
+        end = time.monotonic() + duration
+        while time.monotonic() < end:
+            payload = wait_message(fd, "U", timeout)
+            received_ns = time.monotonic_ns()
+            start_ns = int.from_bytes(payload[4:12], "little")
+            tags = payload[12]
+            durations.setdefault(tags, []).append(
+                (received_ns - start_ns) / 1e9
+            )
+            rounds += 1
+        cpu = cpu_busy_seconds() - cpu_start
+    finally:
+        os.close(fd)
+    return durations, 1000 * cpu / max(rounds, 1)
+
+
+def bench_rounds(device, benchmark, timeout, sim):
+    """Round duration versus number of tags, and CPU per round."""
+    duration = benchmark.get("duration", 10)
+    tag_counts = benchmark.get("tag_counts", [None]) if sim else [None]
+    for count in tag_counts:
+        if count is not None:
+            sim_set_tags(count)
+        durations, cpu_ms = measure_rounds(device, duration, timeout)
+        for tags, values in sorted(durations.items()):
+            yield {
+                "tags": tags,
+                "round": latency_stats(values),
+                "cpu_ms_per_round": cpu_ms,
+            }
+
+
+BENCHMARKS = {
+    "first_uid": bench_first_uid,
+    "poll_once": bench_poll_once,
+    "command": bench_command,
+}
+
+
+def run_scenario(path, args, output):
+    """Run the benchmarks of a scenario file."""
+    with open(path, encoding="utf-8") as scenario_file:
+        scenario = json.load(scenario_file)
+    name = scenario.get("name", os.path.basename(path))
+    for benchmark in scenario["benchmarks"]:
+        kind = benchmark["type"]
+        if args.sim and kind != "rounds":
+            sim_set_tags(benchmark.get("sim_tags", 1))
+        if kind == "rounds":
+            results = bench_rounds(
+                args.device, benchmark, args.timeout, args.sim
+            )
+        else:
+            results = BENCHMARKS[kind](args.device, benchmark, args.timeout)
+        for result in results:
+            record = {
+                "scenario": name,
+                "benchmark": kind,
+                "command": benchmark.get("command"),
+            }
+            record.update(result)
+            record.update(args.environment)
+            output.write(json.dumps(record) + "\n")
+            output.flush()
+            print(summary(record), file=sys.stderr)
+
+
+def summary(record):
+    """Format a result for humans."""
+    text = f"{record['scenario']} {record['benchmark']}"
+    if record.get("command"):
+        text += f" {record['command']} x{record['blocks']}"
+        text += f" {record['blocks_per_s']:.1f} blocks/s"
+    if "tags" in record:
+        text += f" {record['tags']} tags"
+        text += f" round p50 {record['round']['p50_ms']:.1f} ms"
+        text += f" cpu {record['cpu_ms_per_round']:.2f} ms/round"
+    if "latency" in record:
+        text += f" p50 {record['latency']['p50_ms']:.1f} ms"
+        text += f" p99 {record['latency']['p99_ms']:.1f} ms"
+    return text
+
+
+def environment(args):
+    """Describe the system, to compare kernels and boards."""
+    model = None
+    for path in MODEL_PATHS:
+        try:
+            with open(path, encoding="ascii", errors="replace") as file:
+                model = file.read().strip("\0\n")
+            break
+        except OSError:
+            pass
+    return {
+        "kernel": platform.release(),
+        "machine": platform.machine(),
+        "board": args.board or model,
+        "simulated": args.sim,
+        "time": time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+    }
+
+
+def main():
+    """Parse arguments and run scenarios."""
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("scenarios", nargs="+", help="scenario JSON files")
+    parser.add_argument("--device", default=DEVICE)
+    parser.add_argument("--output", help="results file (default: stdout)")
+    parser.add_argument(
+        "--sim", action="store_true", help="place tags on cr14_sim"
+    )
+    parser.add_argument("--board", help="board name, e.g. zero2_64_raspios")
+    parser.add_argument("--timeout", type=float, default=DEFAULT_TIMEOUT)
+    args = parser.parse_args()
+    args.environment = environment(args)
+    output = sys.stdout
+    if args.output:
+        output = open(args.output, "a", encoding="utf-8")
+    try:
+        for path in args.scenarios:
+            run_scenario(path, args, output)
+    except BenchError as error:
+        print(f"Benchmark failed: {error}", file=sys.stderr)
+        return 1
+    finally:
+        if args.output:
+            output.close()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -20,21 +20,134 @@
 #include <linux/delay.h>
 #include <linux/i2c.h>
 #include <linux/circ_buf.h>
+#include <linux/list.h>
+#include <linux/kref.h>
+#include <linux/slab.h>
+#include <linux/mempool.h>
+#include <linux/idr.h>
+#include <linux/sort.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/seqlock.h>
+#include <linux/input.h>
+#include <linux/atomic.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/pm_runtime.h>
+#include <linux/gpio/consumer.h>
+#include <linux/property.h>
+#include <net/genetlink.h>
 
 #include <linux/version.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 12, 0)
+#include <asm/unaligned.h>
+#else
+#include <linux/unaligned.h>
+#endif
+
+#include "cr14.h"
+
+#define CREATE_TRACE_POINTS
+#include "cr14_trace.h"
 
 // ========================================================================== //
 // PROTOCOL
 // ========================================================================== //
 
 // Protocol:
-// A single client can open the device at a time.
+// Several clients can open the device at the same time. Each open file has
+// its own mode, its own command queue and its own stream of messages: the
+// responses to the commands sent by a client are only written to this client.
+// RF sessions are shared: a single anti-collision sequence reports UIDs to
+// every polling client and runs the commands queued by every client, picking
+// the next command of each client in a round-robin fashion.
 //
 // Simple usage consists in opening the device read-only. It is then configured
 // in poll_repeat mode, and it will repeatedly turn the CR14 on and fetch the
 // uids of chips. The UIDs will be written as UID messages.
 // If the device is opened for reading and writing, it will be configured in
 // idle mode (awaiting commands).
+//
+// Sending a command or a mode message (poll once, poll repeat, idle) cancels
+// the polling of the client. Mode messages also cancel the commands queued by
+// the client: once the write of a mode message returns, no response to a
+// command sent before it will be written. A client can queue up to
+// CR14_MAX_QUEUED_COMMANDS (cr14.h) commands, writes block until the queue has
+// room for a new command.
+
+// In poll_repeat mode, UIDs can be deduplicated by setting sysfs attribute
+// dedup_window_ms of the rfid device. A chip is then only reported when it
+// arrives, i.e. when it was not seen during the previous dedup_window_ms
+// milliseconds, and a chip disappearing for a shorter time is not reported
+// again. If sysfs attribute heartbeat_ms is also set, UIDs of chips that are
+// still present are reported again every heartbeat_ms milliseconds.
+
+// Chips currently present, as found by polling, are also available without
+// reading messages: in sysfs attribute tags of the rfid device (one line per
+// chip: <uid in big endian>) and with ioctl CR14_IOC_GET_TAGS, described in
+// cr14.h, which also reports model, arrival and last seen times and link
+// statistics of each chip. The table is emptied when polling stops.
+
+// Memory of chips currently present can also be accessed with pread and
+// pwrite on binary sysfs attributes memory/<uid in big endian> of the rfid
+// device, for example with dd or hexdump. Offsets are in bytes, block n is at
+// offset n * 4. A read or a write is performed as a single read range or
+// write range command, i.e. within a single RF session.
+// Unaligned writes first read the blocks they partially overwrite. Writes fail
+// with EIO if blocks read back do not match (e.g. locked blocks). Accesses time
+// out with ETIMEDOUT if the chip is not found within MEMORY_ACCESS_TIMEOUT_MS
+// milliseconds. Only chips of known models have an attribute.
+
+// If the device tree node has a trigger-gpios property (e.g. a light barrier
+// or door switch), each edge to active state starts a burst of back to back
+// rounds for TRIGGER_BURST_MS milliseconds, instead of polling every
+// POLLING_TIMEOUT_SECS_DIV seconds. If node also has boolean property
+// trigger-suppress-polling, polling only happens while the input is active or
+// during bursts. Commands are always processed.
+
+// RF on-time can be limited with sysfs attribute rf_duty_cycle of the rfid
+// device, in percent of RF_BUDGET_WINDOW_MS windows (default is 100, no
+// limit). Polling is then slowed down so that sessions do not exceed the duty
+// cycle. Once the budget of the window is used, sessions are deferred to next
+// window, except sessions serving realtime commands or polls. Sessions with
+// background priority only are deferred once budget not reserved for
+// interactive commands (RF_BUDGET_RESERVE_PERCENT) is used. Sysfs attribute
+// rf_budget reports <used (ms)> <budget (ms)> <window (ms)> for current
+// window.
+
+// Counters of RF sessions, chips, errors and commands are available in
+// debugfs file cr14/<i2c device>/stats.
+// Latency histograms are available in debugfs file cr14/<i2c device>/histograms,
+// one line per histogram:
+// <name> <count> <p50 (usec)> <p99 (usec)> <bucket 0> ... <bucket 24>
+// Bucket 0 counts durations below 1 usec, bucket n counts durations from
+// 2^(n-1) to 2^n usec and the last bucket counts longer durations.
+// Percentiles are upper bounds of buckets. Writing to the file resets them.
+// Writing to debugfs file cr14/<i2c device>/calibration measures the cost of
+// I2C transfers, sleeps and work dispatch on the running system (sessions are
+// stopped for a few seconds). Reading it reports, one line per measurement:
+// <name> <min (usec)> <p50 (usec)> <p99 (usec)> <max (usec)>
+// for writes of the lengths used by the driver (i2c_write_<bytes>: 1 is a
+// parameter register write, others are frames written with RF off), frame
+// register reads of the lengths used by the driver (i2c_read_<bytes>), work
+// dispatch
+// (workqueue_dispatch) and each wait after a frame
+// (sleep_<min usec>_<max usec>). Wait lines report how much longer than their
+// minimum the waits lasted, followed by the recommended minimum: the smallest
+// minimum for which every measured wait still covers the time the CR14 needs.
+
+// Chip arrivals and departures and command completions are also multicast as
+// generic netlink events, described in cr14.h. Sessions only queue events
+// (up to GENL_EVENTS_QUEUE_SIZE), messages are allocated and sent by a work
+// outside of sessions. Events that do not fit are dropped and counted in
+// debugfs stats (genl_drops).
+//
+// If module parameter input_events is set, chip arrivals and departures are
+// also reported by an input device named "CR14 RFID reader", as:
+// EV_MSC/MSC_SERIAL <uid bytes 0-3 as u32, little endian>
+// EV_MSC/MSC_SERIAL <uid bytes 4-7 as u32, little endian>
+// EV_MSC/MSC_RAW <1 on arrival, 0 on departure>
+// EV_SYN/SYN_REPORT
 
 // ---- UID message ----
 // driver => client
@@ -60,7 +173,9 @@
 #define MESSAGE_POLL_REPEAT_MODE_HEADER 'P'
 
 //
-// An idle message transitions the device in idle mode.
+// An idle message transitions the device in idle mode. If no other client
+// needs the RF field, the running RF session is aborted before next frame and
+// RF is turned off. Closing the device has the same effect.
 
 // ---- Idle message ----
 // client => driver
@@ -112,6 +227,74 @@
 // 'W' <number of addresses (1 byte)> <data in little endian (4 bytes)> ... <data in little endian (4 bytes)>
 #define MESSAGE_WRITE_MULTIPLE_BLOCKS_HEADER 'W'
 
+// Range commands are compact forms of read multiple blocks and write multiple
+// blocks commands, for blocks start, start + stride, ...,
+// start + (count - 1) * stride. A stride of 0 is the same as 1. Addresses
+// must not exceed 255.
+
+// A read range command reads the blocks and writes the result to the device,
+// like a read multiple blocks command.
+
+// ---- Read range messages (request and response) ----
+// client => driver
+// 'g' <uid in little endian (8 bytes)> <start (1 byte)> <count (1 byte)> <stride (1 byte)>
+// driver => client
+// 'g' <count (1 byte)> <data in little endian (4 bytes)> ... <data in little endian (4 bytes)>
+#define MESSAGE_READ_RANGE_HEADER 'g'
+
+// A write range command writes the blocks and reads them back, like a write
+// multiple blocks command, but only writes the number of blocks that do not
+// hold the written data (0 on success) to the device.
+
+// ---- Write range messages (request and response) ----
+// client => driver
+// 'h' <uid in little endian (8 bytes)> <start (1 byte)> <count (1 byte)> <stride (1 byte)> <data in little endian (4 bytes)> ... <data in little endian (4 bytes)>
+// driver => client
+// 'h' <number of mismatching blocks (1 byte)>
+#define MESSAGE_WRITE_RANGE_HEADER 'h'
+
+// A fill range command is a write range command writing the same data to
+// every block, for example FFFFFFFF to erase blocks.
+
+// ---- Fill range messages (request and response) ----
+// client => driver
+// 'f' <uid in little endian (8 bytes)> <start (1 byte)> <count (1 byte)> <stride (1 byte)> <data in little endian (4 bytes)>
+// driver => client
+// 'f' <number of mismatching blocks (1 byte)>
+#define MESSAGE_FILL_RANGE_HEADER 'f'
+
+// A priority class message sets the priority class of the subsequent commands
+// and of the polling of the client. Within a RF session, commands and UIDs are
+// processed by decreasing priority (realtime first). A realtime command or
+// poll preempts a running session between two frames, unless the session is
+// itself serving a realtime command.
+// Clients opened read-only default to background class, other clients default
+// to interactive class.
+// Average and maximum latencies per class are reported in sysfs attribute
+// latency of the rfid device.
+
+// ---- Priority class message ----
+// client => driver
+// 'c' <class (1 byte): 0 = realtime, 1 = interactive, 2 = background>
+#define MESSAGE_PRIORITY_CLASS_HEADER 'c'
+
+// A round summary message enables or disables round summaries for a polling
+// client. When enabled, the client no longer gets UID messages but a single
+// summary message at the end of each inventory round, with the UIDs of every
+// chip found during the round. Round id is incremented for every RF session
+// and timestamp is the CLOCK_MONOTONIC time of the start of the round, in
+// nanoseconds. Rounds interrupted by cancellation are not reported.
+// In poll repeat mode, summaries are written even if no chip was found.
+// In poll once mode, the first summary with at least one chip is written and
+// the client then transitions to idle mode.
+
+// ---- Round summary messages (request and response) ----
+// client => driver
+// 'U' <enabled (1 byte): 0 or 1>
+// driver => client
+// 'U' <round id (4 bytes, little endian)> <timestamp (8 bytes, little endian)> <number of uids (1 byte)> <uid in little endian (8 bytes)> ... <uid in little endian (8 bytes)>
+#define MESSAGE_ROUND_SUMMARY_HEADER 'U'
+
 // ========================================================================== //
 // Definitions and data structures
 // ========================================================================== //
@@ -146,6 +329,23 @@
 #define COMMAND_COMPLETION 0x0F
 
 #define POLLING_TIMEOUT_SECS_DIV 2
+// Longer than polling period, so that polling keeps the device active.
+#define AUTOSUSPEND_DELAY_MS 1000
+
+#define TRIGGER_BURST_MS 2000
+
+#define RF_BUDGET_WINDOW_MS 10000
+#define RF_BUDGET_RESERVE_PERCENT 25
+
+// Consecutive failed sessions before recovering the bus and the CR14.
+#define RECOVERY_FAULT_THRESHOLD 3
+#define RECOVERY_RETRY_MS 250
+#define RECOVERY_MAX_RETRY_MS 4000
+
+// Samples of each measurement of the calibration.
+#define CALIBRATION_SAMPLES 100
+#define CALIBRATION_WRITE_LENGTHS 4
+#define CALIBRATION_READ_LENGTHS 5
 
 enum cr14_mode {
 	mode_idle,
@@ -154,7 +354,17 @@ enum cr14_mode {
 	mode_read_single_block,
 	mode_write_single_block,
 	mode_read_multiple_blocks,
-	mode_write_multiple_blocks
+	mode_write_multiple_blocks,
+	mode_read_range,
+	mode_write_range,
+	mode_fill_range
+};
+
+enum cr14_priority {
+	priority_realtime,
+	priority_interactive,
+	priority_background,
+	priority_classes_count
 };
 
 #define MAX_PACKET_SIZE 1285
@@ -162,6 +372,52 @@ enum cr14_mode {
 
 #define IO_FRAME_REGISTER_MAX_RETRIES 200
 
+#define CLIENT_MAX_QUEUED_COMMANDS CR14_MAX_QUEUED_COMMANDS
+#define COMMAND_POOL_RESERVE CLIENT_MAX_QUEUED_COMMANDS
+
+#define RESPONSE_MAX_SIZE (2 + (255 * 4))
+
+#define ROUND_MAX_UIDS 255
+
+#define MAX_PRESENT_TAGS CR14_MAX_TAGS
+
+// Netlink events waiting for genl_work: every present chip leaving and as many
+// arriving.
+#define GENL_EVENTS_QUEUE_SIZE (2 * MAX_PRESENT_TAGS)
+
+#define UID_MANUFACTURER_ST 0x02
+#define MEMORY_ACCESS_TIMEOUT_MS 2000
+
+#define HISTOGRAM_BUCKETS 25
+#define ROUND_SUMMARY_MESSAGE_SIZE (14 + (ROUND_MAX_UIDS * 8))
+
+// Waits after writing a frame, for the CR14 to send it and receive the reply.
+enum cr14_wait {
+	wait_one_byte_frame,
+	wait_two_bytes_frame,
+	wait_get_uid,
+	wait_write_block,
+	wait_slots,
+	waits_count
+};
+
+enum cr14_histogram {
+	histogram_time_to_uid, // RF on to first UID of session
+	histogram_select_to_uid, // select frame to UID read
+	histogram_read_block,
+	histogram_write_block,
+	// Submission to response, per command type (same order as modes)
+	histogram_read_single_block_command,
+	histogram_write_single_block_command,
+	histogram_read_multiple_blocks_command,
+	histogram_write_multiple_blocks_command,
+	histogram_read_range_command,
+	histogram_write_range_command,
+	histogram_fill_range_command,
+	histogram_ring_dwell, // oldest unread message to read by client
+	histograms_count
+};
+
 // Data structures
 
 struct cr14_read_single_block_command_params {
@@ -195,34 +451,204 @@ union cr14_command_params {
 	struct cr14_write_multiple_blocks_command_params write_multiple_blocks;
 };
 
-struct cr14_i2c_data {
-	struct i2c_client *i2c;
-	dev_t chrdev;
-	struct class *cr14_class;
-	struct cdev cdev;
-	struct device *device;
-	struct timer_list polling_timer;
-	struct work_struct polling_work;
+struct cr14_i2c_data;
+
+struct cr14_client;
+
+struct cr14_command {
+	struct list_head list; // in client queue or in session batch
+	struct cr14_client *client;
+	enum cr14_mode mode;
+	bool cancelled; // client changed mode while command was running
+	enum cr14_priority priority;
+	ktime_t submitted;
+	union cr14_command_params params;
+};
+
+struct cr14_tag {
+	u8 uid[8];
+	enum cr14_tag_model model;
+	ktime_t first_seen;
+	ktime_t last_seen;
+	ktime_t last_reported; // last UID message, for deduplication
+	struct cr14_tag_link link;
+};
+
+enum cr14_link_event {
+	link_frame,
+	link_crc_error,
+	link_no_response,
+	link_collision,
+	link_retry,
+};
+
+struct cr14_latency_stats {
+	u64 count;
+	u64 total_ns;
+	u64 max_ns;
+};
+
+// Counters, reported in debugfs.
+struct cr14_stats {
+	atomic64_t rounds; // RF sessions
+	atomic64_t uids; // UIDs read
+	atomic64_t collisions; // anti-collision sequences requiring slot markers
+	atomic64_t crc_errors;
+	atomic64_t no_response; // selected chip or block did not reply
+	atomic64_t i2c_errors;
+	atomic64_t frame_retries; // frame register not ready
+	atomic64_t ring_drops; // messages dropped as client did not read
+	atomic64_t genl_drops; // netlink events dropped as queue was full
+	atomic64_t commands_completed;
+	atomic64_t commands_cancelled;
+	atomic64_t commands_retried; // attempts that failed, to be retried
+	atomic64_t rf_on_ns;
+	atomic64_t budget_deferrals; // sessions deferred by RF duty cycle budget
+	atomic64_t recoveries; // CR14 answered again after failed sessions
+	atomic64_t recovery_failures; // recovery attempts that failed
+};
+
+// Durations, in log2 buckets of microseconds.
+struct cr14_histogram_data {
+	atomic64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+struct cr14_client {
+	struct cr14_i2c_data *priv;
+	struct list_head list; // in priv->clients
+	struct kref kref;
 	spinlock_t producer_lock;
-	spinlock_t consumer_lock;
+	struct mutex consumer_lock;
 	wait_queue_head_t read_wq;
 	wait_queue_head_t write_wq;
 	int read_buffer_head;
 	int read_buffer_tail;
 	char read_buffer[CIRCULAR_BUFFER_SIZE];
+	ktime_t oldest_unread; // protected by producer_lock
 	int write_offset; // current offset in write buffer
-	char write_buffer[MAX_PACKET_SIZE];
-	struct mutex command_lock; // locks mode and params
-	unsigned opened : 1; // whether the device is opened
-	unsigned running_command : 1; // whether we're currently running a command
-	enum cr14_mode mode;
-	union cr14_command_params command_params;
+	u8 write_buffer[MAX_PACKET_SIZE];
+	// Following fields are protected by priv->command_lock
+	unsigned closed : 1; // whether the file was released
+	enum cr14_mode mode; // mode_idle, mode_poll_once or mode_poll_repeat
+	enum cr14_priority priority;
+	unsigned round_summary : 1; // whether client gets round summaries
+	ktime_t poll_submitted; // when client entered poll once mode
+	struct list_head commands; // queued commands
+	int queued_commands;
+};
+
+// Measured durations, in ns.
+struct cr14_calibration_stats {
+	s64 min_ns;
+	s64 p50_ns;
+	s64 p99_ns;
+	s64 max_ns;
+};
+
+struct cr14_calibration {
+	int result; // 1 if never run, 0 if done, error otherwise
+	struct cr14_calibration_stats i2c_write[CALIBRATION_WRITE_LENGTHS];
+	struct cr14_calibration_stats i2c_read[CALIBRATION_READ_LENGTHS];
+	struct cr14_calibration_stats workqueue_dispatch;
+	struct cr14_calibration_stats sleep_overshoot[waits_count];
+};
+
+// Netlink event, queued by sessions and multicast by genl_work.
+struct cr14_genl_event {
+	u64 timestamp;
+	u8 uid[8];
+	u8 cmd;
+	u8 group;
+	u8 command; // 0 if not a command completion
+	int model; // -1 if not a chip arrival or departure
+	int status;
+};
+
+// Binary sysfs attribute of a present chip.
+struct cr14_memory_node {
+	struct cr14_i2c_data *priv;
+	bool used;
+	u8 uid[8];
+	char name[17];
+	struct bin_attribute attr;
+};
+
+struct cr14_i2c_data {
+	struct i2c_client *i2c;
+	dev_t chrdev;
+	int index; // N of /dev/rfidN
+	struct cdev cdev;
+	struct device *device;
+	struct timer_list polling_timer;
+	struct work_struct polling_work;
+	struct mutex command_lock; // locks clients, their modes and queues
+	struct list_head clients; // opened files, in scheduling order
+	int clients_count;
+	struct list_head batch; // commands of current session (worker only)
+	mempool_t *command_pool;
+	u8 response[RESPONSE_MAX_SIZE]; // worker only
+	bool preempt; // a realtime command or poll is waiting
+	bool abort; // no client needs current session anymore
+	bool suspended; // system sleep, sessions are not started
+	bool calibrating; // sessions are not started either
+	struct gpio_desc *trigger_gpio; // NULL without trigger-gpios
+	bool trigger_suppress; // only poll while trigger is active
+	unsigned long burst_end; // jiffies
+	struct cr14_latency_stats latency[priority_classes_count];
+	// Current inventory round (worker only)
+	u32 round_id;
+	ktime_t round_start;
+	int round_count;
+	u8 round_uids[ROUND_MAX_UIDS][8];
+	u8 round_message[ROUND_SUMMARY_MESSAGE_SIZE];
+	// Present chips, written by worker only
+	seqlock_t tags_lock;
+	int tags_count;
+	struct cr14_tag tags[MAX_PRESENT_TAGS];
+	struct cr14_tag *selected_tag; // for link statistics, worker only
+	unsigned int dedup_window_ms;
+	unsigned int heartbeat_ms;
+	struct input_dev *input; // NULL unless input_events is set
+	struct cr14_stats stats;
+	struct cr14_histogram_data histograms[histograms_count];
+	ktime_t rf_on_since; // worker only
+	u64 session_rf_ns; // RF on-time of last session, worker only
+	// Fault recovery (worker only)
+	int faults; // consecutive failed sessions
+	bool recovering; // sessions wait for the CR14 to be recovered
+	int recovery_attempts;
+	// RF duty cycle budget
+	unsigned int rf_duty_cycle; // percent
+	spinlock_t budget_lock; // locks budget window
+	ktime_t budget_window_start;
+	u64 budget_used_ns;
+	struct dentry *debugfs;
+	struct mutex calibration_lock; // locks calibration
+	struct cr14_calibration calibration;
+	// Memory attributes, synchronized with present chips by memory_work
+	struct kobject *memory_kobj;
+	struct work_struct memory_work;
+	struct mutex memory_lock; // locks memory_nodes and memory_closing
+	bool memory_closing;
+	struct cr14_tag memory_tags[MAX_PRESENT_TAGS]; // copy of present chips
+	struct cr14_memory_node memory_nodes[MAX_PRESENT_TAGS];
+	// Netlink events, multicast by genl_work outside of sessions
+	struct work_struct genl_work;
+	spinlock_t genl_lock; // locks genl_events, genl_head and genl_count
+	struct cr14_genl_event genl_events[GENL_EVENTS_QUEUE_SIZE];
+	unsigned int genl_head; // oldest event
+	unsigned int genl_count;
 };
 
 // Prototypes
 
 static void cr14_polling_timer_cb(struct timer_list *t);
-static void restart_polling_timer(struct cr14_i2c_data *priv);
+static void restart_polling_timer(struct cr14_i2c_data *priv,
+				  unsigned long delay);
+static void cr14_client_release(struct kref *kref);
+static void cr14_free_command(struct cr14_command *cmd);
+static void cr14_cancel_command(struct cr14_i2c_data *priv,
+				struct cr14_command *cmd);
 
 static int cr14_open(struct inode *inode, struct file *file);
 static int cr14_release(struct inode *inode, struct file *file);
@@ -244,22 +670,216 @@ static int cr14_i2c_remove(struct i2c_client *client);
 static void cr14_i2c_remove(struct i2c_client *client);
 #endif
 
+// ========================================================================== //
+// Events
+// ========================================================================== //
+
+static bool input_events;
+module_param(input_events, bool, 0444);
+MODULE_PARM_DESC(input_events,
+		 "Report chip arrivals and departures with an input device");
+
+enum cr14_genl_groups {
+	CR14_GENL_MCGRP_ARRIVAL,
+	CR14_GENL_MCGRP_DEPARTURE,
+	CR14_GENL_MCGRP_COMMAND,
+};
+
+static const struct genl_multicast_group cr14_genl_mcgrps[] = {
+	[CR14_GENL_MCGRP_ARRIVAL] = { .name = CR14_GENL_MCGRP_ARRIVAL_NAME },
+	[CR14_GENL_MCGRP_DEPARTURE] = { .name = CR14_GENL_MCGRP_DEPARTURE_NAME },
+	[CR14_GENL_MCGRP_COMMAND] = { .name = CR14_GENL_MCGRP_COMMAND_NAME },
+};
+
+static struct genl_family cr14_genl_family __ro_after_init = {
+	.module = THIS_MODULE,
+	.name = CR14_GENL_NAME,
+	.version = CR14_GENL_VERSION,
+	.maxattr = CR14_ATTR_MAX,
+	.mcgrps = cr14_genl_mcgrps,
+	.n_mcgrps = ARRAY_SIZE(cr14_genl_mcgrps),
+};
+
+// Queue an event for genl_work, if anyone listens to its group. Messages are
+// allocated by genl_work, not by sessions: events are dropped if the queue is
+// full. model is ignored if negative, command if zero.
+static void cr14_genl_notify(struct cr14_i2c_data *priv, u8 cmd,
+			     enum cr14_genl_groups group, const u8 *uid,
+			     int model, u8 command, int status)
+{
+	struct cr14_genl_event *event;
+
+	if (!genl_has_listeners(&cr14_genl_family, &init_net, group)) {
+		return;
+	}
+	spin_lock(&priv->genl_lock);
+	if (priv->genl_count == GENL_EVENTS_QUEUE_SIZE) {
+		spin_unlock(&priv->genl_lock);
+		atomic64_inc(&priv->stats.genl_drops);
+		return;
+	}
+	event = &priv->genl_events[(priv->genl_head + priv->genl_count) %
+				   GENL_EVENTS_QUEUE_SIZE];
+	event->timestamp = ktime_get_ns();
+	memcpy(event->uid, uid, sizeof(event->uid));
+	event->cmd = cmd;
+	event->group = group;
+	event->command = command;
+	event->model = model;
+	event->status = status;
+	priv->genl_count++;
+	spin_unlock(&priv->genl_lock);
+	schedule_work(&priv->genl_work);
+}
+
+// Multicast an event.
+static void cr14_genl_multicast(struct cr14_i2c_data *priv,
+				const struct cr14_genl_event *event)
+{
+	struct sk_buff *skb;
+	void *hdr;
+	size_t size;
+
+	size = nla_total_size(sizeof(u32)) + nla_total_size(8) +
+	       nla_total_size(sizeof(u32)) + nla_total_size_64bit(sizeof(u64)) +
+	       nla_total_size(sizeof(u8)) + nla_total_size(sizeof(s32));
+	skb = genlmsg_new(size, GFP_KERNEL);
+	if (!skb) {
+		return;
+	}
+	hdr = genlmsg_put(skb, 0, 0, &cr14_genl_family, 0, event->cmd);
+	if (!hdr) {
+		nlmsg_free(skb);
+		return;
+	}
+	if (nla_put_u32(skb, CR14_ATTR_READER, priv->index) ||
+	    nla_put(skb, CR14_ATTR_UID, 8, event->uid) ||
+	    nla_put_u64_64bit(skb, CR14_ATTR_TIMESTAMP, event->timestamp,
+			      CR14_ATTR_PAD) ||
+	    (event->model >= 0 &&
+	     nla_put_u32(skb, CR14_ATTR_MODEL, event->model)) ||
+	    (event->command &&
+	     (nla_put_u8(skb, CR14_ATTR_COMMAND, event->command) ||
+	      nla_put_s32(skb, CR14_ATTR_STATUS, event->status)))) {
+		genlmsg_cancel(skb, hdr);
+		nlmsg_free(skb);
+		return;
+	}
+	genlmsg_end(skb, hdr);
+	genlmsg_multicast(&cr14_genl_family, skb, 0, event->group, GFP_KERNEL);
+}
+
+// Multicast queued events, in order.
+static void cr14_genl_work_fn(struct work_struct *work)
+{
+	struct cr14_i2c_data *priv =
+		container_of(work, struct cr14_i2c_data, genl_work);
+	struct cr14_genl_event event;
+
+	for (;;) {
+		spin_lock(&priv->genl_lock);
+		if (priv->genl_count == 0) {
+			spin_unlock(&priv->genl_lock);
+			break;
+		}
+		event = priv->genl_events[priv->genl_head];
+		priv->genl_head = (priv->genl_head + 1) % GENL_EVENTS_QUEUE_SIZE;
+		priv->genl_count--;
+		spin_unlock(&priv->genl_lock);
+		cr14_genl_multicast(priv, &event);
+	}
+}
+
+static int cr14_input_init(struct cr14_i2c_data *priv)
+{
+	struct input_dev *input;
+	int err;
+
+	input = devm_input_allocate_device(&priv->i2c->dev);
+	if (!input) {
+		return -ENOMEM;
+	}
+	input->name = "CR14 RFID reader";
+	input->phys = DRV_NAME "/input0";
+	input->id.bustype = BUS_I2C;
+	input_set_capability(input, EV_MSC, MSC_SERIAL);
+	input_set_capability(input, EV_MSC, MSC_RAW);
+	err = input_register_device(input);
+	if (err) {
+		return err;
+	}
+	priv->input = input;
+	return 0;
+}
+
+static void cr14_input_report(struct cr14_i2c_data *priv, const u8 *uid,
+			      bool present)
+{
+	if (!priv->input) {
+		return;
+	}
+	input_event(priv->input, EV_MSC, MSC_SERIAL, get_unaligned_le32(uid));
+	input_event(priv->input, EV_MSC, MSC_SERIAL,
+		    get_unaligned_le32(uid + 4));
+	input_event(priv->input, EV_MSC, MSC_RAW, present);
+	input_sync(priv->input);
+}
+
+static void cr14_notify_arrival(struct cr14_i2c_data *priv, const u8 *uid,
+				enum cr14_tag_model model)
+{
+	cr14_genl_notify(priv, CR14_CMD_TAG_ARRIVAL, CR14_GENL_MCGRP_ARRIVAL,
+			 uid, model, 0, 0);
+	cr14_input_report(priv, uid, true);
+	schedule_work(&priv->memory_work);
+}
+
+static void cr14_notify_departure(struct cr14_i2c_data *priv, const u8 *uid,
+				  enum cr14_tag_model model)
+{
+	cr14_genl_notify(priv, CR14_CMD_TAG_DEPARTURE,
+			 CR14_GENL_MCGRP_DEPARTURE, uid, model, 0, 0);
+	cr14_input_report(priv, uid, false);
+	schedule_work(&priv->memory_work);
+}
+
+static void cr14_notify_command(struct cr14_i2c_data *priv, const u8 *uid,
+				u8 command, int status)
+{
+	cr14_genl_notify(priv, CR14_CMD_COMMAND_COMPLETE,
+			 CR14_GENL_MCGRP_COMMAND, uid, -1, command, status);
+}
+
 // ========================================================================== //
 // Polling code
 // ========================================================================== //
 
-static s32 cr14_write_register_byte_check(struct i2c_client *i2c, u8 reg,
+// Account the duration of a phase that started at start.
+static void cr14_histogram_add(struct cr14_i2c_data *priv,
+			       enum cr14_histogram histogram, ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+	int bucket = us > 0 ? fls64(us) : 0;
+	if (bucket >= HISTOGRAM_BUCKETS) {
+		bucket = HISTOGRAM_BUCKETS - 1;
+	}
+	atomic64_inc(&priv->histograms[histogram].buckets[bucket]);
+}
+
+static s32 cr14_write_register_byte_check(struct cr14_i2c_data *priv, u8 reg,
 					  u8 value)
 {
 	s32 result;
 	do {
-		result = i2c_smbus_write_byte_data(i2c, reg, value);
+		result = i2c_smbus_write_byte_data(priv->i2c, reg, value);
 		if (result < 0) {
+			atomic64_inc(&priv->stats.i2c_errors);
 			break;
 		}
 
-		result = i2c_smbus_read_byte_data(i2c, reg);
+		result = i2c_smbus_read_byte_data(priv->i2c, reg);
 		if (result < 0) {
+			atomic64_inc(&priv->stats.i2c_errors);
 			break;
 		}
 
@@ -272,130 +892,646 @@ static s32 cr14_write_register_byte_check(struct i2c_client *i2c, u8 reg,
 	return result;
 }
 
-static int cr14_read_io_frame_register(struct i2c_client *i2c, int len,
-				       u8 *buffer)
+// Start a new budget window if current one is over.
+// Called with budget_lock held.
+static void cr14_budget_roll(struct cr14_i2c_data *priv, ktime_t now)
+{
+	if (ktime_ms_delta(now, priv->budget_window_start) >=
+	    RF_BUDGET_WINDOW_MS) {
+		priv->budget_window_start = now;
+		priv->budget_used_ns = 0;
+	}
+}
+
+static void cr14_budget_account(struct cr14_i2c_data *priv, u64 rf_ns)
+{
+	spin_lock(&priv->budget_lock);
+	cr14_budget_roll(priv, ktime_get());
+	priv->budget_used_ns += rf_ns;
+	spin_unlock(&priv->budget_lock);
+}
+
+// RF on-time budget of a window, in ns, for sessions of given priority.
+static u64 cr14_budget_ns(unsigned int duty_cycle, enum cr14_priority priority)
+{
+	u64 budget_ns = (u64)RF_BUDGET_WINDOW_MS * NSEC_PER_MSEC / 100 *
+			duty_cycle;
+	if (priority == priority_background) {
+		budget_ns -= div_u64(budget_ns * RF_BUDGET_RESERVE_PERCENT, 100);
+	}
+	return budget_ns;
+}
+
+// Determine if a session of given priority can start.
+// Return 0 if it can, or delay in jiffies until next window.
+static unsigned long cr14_budget_delay(struct cr14_i2c_data *priv,
+				       enum cr14_priority priority)
+{
+	unsigned int duty_cycle = READ_ONCE(priv->rf_duty_cycle);
+	ktime_t now = ktime_get();
+	s64 remaining_ms;
+	u64 used_ns;
+	if (duty_cycle >= 100 || priority == priority_realtime) {
+		return 0;
+	}
+	spin_lock(&priv->budget_lock);
+	cr14_budget_roll(priv, now);
+	used_ns = priv->budget_used_ns;
+	remaining_ms = RF_BUDGET_WINDOW_MS -
+		       ktime_ms_delta(now, priv->budget_window_start);
+	spin_unlock(&priv->budget_lock);
+	if (used_ns < cr14_budget_ns(duty_cycle, priority)) {
+		return 0;
+	}
+	return max(msecs_to_jiffies(remaining_ms), 1UL);
+}
+
+// Determine if rounds should run back to back, after a trigger.
+static bool cr14_in_burst(struct cr14_i2c_data *priv)
+{
+	return priv->trigger_gpio &&
+	       time_before(jiffies, READ_ONCE(priv->burst_end));
+}
+
+// Determine if polling is suppressed, as trigger is inactive.
+static bool cr14_polling_suppressed(struct cr14_i2c_data *priv)
+{
+	if (!priv->trigger_suppress || cr14_in_burst(priv)) {
+		return false;
+	}
+	return gpiod_get_value_cansleep(priv->trigger_gpio) == 0;
+}
+
+// Delay before next session: polling period, or none during a burst or if
+// sessions should run back to back, stretched so that sessions do not exceed
+// RF duty cycle.
+static unsigned long cr14_polling_delay(struct cr14_i2c_data *priv,
+					bool back_to_back)
+{
+	unsigned long delay = back_to_back || cr14_in_burst(priv) ?
+				      0 :
+				      HZ / POLLING_TIMEOUT_SECS_DIV;
+	unsigned int duty_cycle = READ_ONCE(priv->rf_duty_cycle);
+	if (duty_cycle < 100) {
+		u64 off_ns = div_u64(priv->session_rf_ns * (100 - duty_cycle),
+				     duty_cycle);
+		delay = max(delay, nsecs_to_jiffies(off_ns));
+	}
+	return delay;
+}
+
+// Turn RF on or off, accounting RF on-time.
+static s32 cr14_set_rf(struct cr14_i2c_data *priv, bool on)
+{
+	s32 result;
+	if (on) {
+		result = cr14_write_register_byte_check(
+			priv, CRX14_PARAMETER_REGISTER,
+			CARRIER_FREQ_RF_OUT_ON | WATCHDOG_TIMEOUT_5US);
+		if (result < 0) {
+			dev_err_ratelimited(&priv->i2c->dev,
+					    "Turning RF on failed (%d)", result);
+		}
+		priv->rf_on_since = ktime_get();
+	} else {
+		result = i2c_smbus_write_byte_data(
+			priv->i2c, CRX14_PARAMETER_REGISTER,
+			CARRIER_FREQ_RF_OUT_OFF | WATCHDOG_TIMEOUT_5US);
+		if (result < 0) {
+			atomic64_inc(&priv->stats.i2c_errors);
+			dev_err_ratelimited(&priv->i2c->dev,
+					    "Turning RF off failed (%d)", result);
+		}
+		if (priv->rf_on_since) {
+			u64 rf_ns = ktime_to_ns(
+				ktime_sub(ktime_get(), priv->rf_on_since));
+			atomic64_add(rf_ns, &priv->stats.rf_on_ns);
+			cr14_budget_account(priv, rf_ns);
+			priv->session_rf_ns = rf_ns;
+			priv->rf_on_since = 0;
+		}
+	}
+	trace_cr14_rf(on, result);
+	return result;
+}
+
+// Write a frame (length byte followed by data) to the frame register.
+static s32 cr14_write_frame(struct cr14_i2c_data *priv, int len,
+			    const u8 *buffer)
+{
+	s32 result;
+	result = i2c_smbus_write_i2c_block_data(
+		priv->i2c, CRX14_IO_FRAME_REGISTER, len, buffer);
+	trace_cr14_frame_write(buffer[0], buffer[1], result);
+	if (result < 0) {
+		atomic64_inc(&priv->stats.i2c_errors);
+		dev_err_ratelimited(&priv->i2c->dev,
+				    "Writing frame register failed (%d)",
+				    result);
+	}
+	return result;
+}
+
+// Read a frame (length byte followed by data) from the frame register,
+// waiting for the CR14 to be ready.
+static int cr14_read_frame(struct cr14_i2c_data *priv, int len, u8 *buffer)
 {
 	s32 result;
 	int retries = 0;
 	do {
 		result = i2c_smbus_read_i2c_block_data(
-			i2c, CRX14_IO_FRAME_REGISTER, len, buffer);
+			priv->i2c, CRX14_IO_FRAME_REGISTER, len, buffer);
 		if (result == -EREMOTEIO || result == -ETIMEDOUT) {
+			atomic64_inc(&priv->stats.frame_retries);
 			retries++;
 		} else if (result != len) {
-			dev_err(&i2c->dev,
+			dev_err_ratelimited(
+				&priv->i2c->dev,
 				"Reading frame register failed (requested %d bytes, got %d)",
 				len, result);
 			result = -1;
 		}
 	} while ((result == -EREMOTEIO || result == -ETIMEDOUT) &&
 		 retries < IO_FRAME_REGISTER_MAX_RETRIES);
+	trace_cr14_frame_read(result < 0 ? 0 : buffer[0], retries, result);
+	if (result < 0) {
+		atomic64_inc(&priv->stats.i2c_errors);
+		if (result != -1) {
+			dev_err_ratelimited(&priv->i2c->dev,
+					    "Reading frame register failed (%d)",
+					    result);
+		}
+	}
+	return result;
+}
+
+static s32 cr14_write_slot_marker(struct cr14_i2c_data *priv)
+{
+	s32 result;
+	result = i2c_smbus_write_byte(priv->i2c, CRX14_SLOT_MARKER_REGISTER);
+	trace_cr14_slot_marker(result);
+	if (result < 0) {
+		atomic64_inc(&priv->stats.i2c_errors);
+		dev_err_ratelimited(&priv->i2c->dev,
+				    "Writing slot marker register failed (%d)",
+				    result);
+	}
 	return result;
 }
 
-static void cr14_write_to_device(struct cr14_i2c_data *priv, int count,
+// Minimum and maximum of each wait, in usec. Minimums are the time for the
+// CR14 to send the frame and receive the reply, see where they are used.
+static const unsigned long cr14_waits[waits_count][2] = {
+	[wait_one_byte_frame] = { 1200, 2000 },
+	[wait_two_bytes_frame] = { 1250, 2000 },
+	[wait_get_uid] = { 1900, 5000 },
+	[wait_write_block] = { 8650, 10000 },
+	[wait_slots] = { 16000, 20000 },
+};
+
+static void cr14_wait(enum cr14_wait wait)
+{
+	usleep_range(cr14_waits[wait][0], cr14_waits[wait][1]);
+}
+
+// CRC mismatch, reset to inventory for next anti-collision sequence.
+static void cr14_reset_to_inventory(struct cr14_i2c_data *priv)
+{
+	u8 buffer[2];
+	atomic64_inc(&priv->stats.crc_errors);
+	buffer[0] = 1;
+	buffer[1] = COMMAND_RESET_TO_INVENTORY;
+	cr14_write_frame(priv, 2, buffer);
+	// 1 byte: 651 usec + watchdog-timeout.
+	cr14_wait(wait_one_byte_frame);
+}
+
+static void cr14_write_to_device(struct cr14_client *client, int count,
 				 u8 *data)
 {
 	int ix;
-	spin_lock(&priv->producer_lock);
+	spin_lock(&client->producer_lock);
+	if (client->read_buffer_head == READ_ONCE(client->read_buffer_tail)) {
+		client->oldest_unread = ktime_get();
+	}
 	for (ix = 0; ix < count; ix++) {
-		unsigned long head = priv->read_buffer_head;
+		unsigned long head = client->read_buffer_head;
 		/* The spin_unlock() and next spin_lock() provide needed ordering. */
-		unsigned long tail = READ_ONCE(priv->read_buffer_tail);
+		unsigned long tail = READ_ONCE(client->read_buffer_tail);
 		if (CIRC_SPACE(head, tail, CIRCULAR_BUFFER_SIZE) >=
 		    count - ix) {
-			priv->read_buffer[head] = data[ix];
-			smp_store_release(&priv->read_buffer_head,
+			client->read_buffer[head] = data[ix];
+			smp_store_release(&client->read_buffer_head,
 					  (head + 1) &
 						  (CIRCULAR_BUFFER_SIZE - 1));
 		} else {
-			dev_err(&priv->i2c->dev,
+			atomic64_inc(&client->priv->stats.ring_drops);
+			dev_err_ratelimited(
+				&client->priv->i2c->dev,
 				"Not writing to device as circular buffer would overflow");
 			break;
 		}
 	}
-	wake_up_interruptible(&priv->read_wq);
-	spin_unlock(&priv->producer_lock);
+	wake_up_interruptible(&client->read_wq);
+	spin_unlock(&client->producer_lock);
 }
 
-static void cr14_process_polling(struct cr14_i2c_data *priv, const u8 *uid)
+// Write the response of a command, unless its client cancelled it while it
+// was running, so that no response of a cancelled command follows a mode
+// message.
+// Return 0 or -ECANCELED.
+static int cr14_write_response(struct cr14_i2c_data *priv,
+			       struct cr14_command *cmd, int count, u8 *data)
 {
-	u8 buffer[9];
-	buffer[0] = MESSAGE_UID_HEADER;
-	memcpy(buffer + 1, uid, sizeof(buffer) - 1);
-	cr14_write_to_device(priv, sizeof(buffer), buffer);
-
-	if (priv->mode == mode_poll_once) {
-		priv->mode = mode_idle;
+	int result = -ECANCELED;
+	mutex_lock(&priv->command_lock);
+	if (!cmd->cancelled) {
+		cr14_write_to_device(cmd->client, count, data);
+		result = 0;
 	}
+	mutex_unlock(&priv->command_lock);
+	return result;
 }
 
-static int cr14_write_block(struct i2c_client *i2c, u8 addr, const u8 *data)
+// Account the latency of a command or poll once request.
+// Called with command_lock held.
+static void cr14_record_latency(struct cr14_i2c_data *priv,
+				enum cr14_priority priority, ktime_t submitted)
 {
-	s32 result;
-	u8 buffer[7];
-	buffer[0] = 6;
-	buffer[1] = COMMAND_WRITE_BLOCK_H;
-	buffer[2] = addr;
-	buffer[3] = data[0];
-	buffer[4] = data[1];
-	buffer[5] = data[2];
-	buffer[6] = data[3];
-	result = i2c_smbus_write_i2c_block_data(i2c, CRX14_IO_FRAME_REGISTER, 7,
-						buffer);
-	if (result < 0) {
-		dev_err(&i2c->dev, "Writing frame register failed (%d)",
-			result);
-	} else {
-		// 6 bytes + 7ms worst case (binary counter decrement)
-		usleep_range(8650, 10000);
+	struct cr14_latency_stats *stats = &priv->latency[priority];
+	u64 latency_ns = ktime_to_ns(ktime_sub(ktime_get(), submitted));
+	stats->count++;
+	stats->total_ns += latency_ns;
+	if (latency_ns > stats->max_ns) {
+		stats->max_ns = latency_ns;
 	}
-	return result;
 }
 
-// Return 0 on success.
-// 1 on collision
-// 2 if chip disappeared
-// negative value on error.
-static int cr14_read_block(struct i2c_client *i2c, u8 addr, u8 *data)
+// Determine if current session should stop between two frames, either
+// because no client needs it anymore or to let a realtime command or poll run,
+// when serving a request of given priority.
+static bool cr14_session_cancelled(struct cr14_i2c_data *priv,
+				   enum cr14_priority priority)
 {
-	s32 result;
-	u8 buffer[5];
-	buffer[0] = 2;
-	buffer[1] = COMMAND_READ_BLOCK_H;
-	buffer[2] = addr;
-	result = i2c_smbus_write_i2c_block_data(i2c, CRX14_IO_FRAME_REGISTER, 3,
-						buffer);
-	if (result < 0) {
-		dev_err(&i2c->dev, "Writing frame register failed (%d)",
-			result);
-	} else {
-		// 2 bytes, see below
-		usleep_range(1250, 2000);
-		result = cr14_read_io_frame_register(i2c, 5, buffer);
-		if (result < 0) {
-			dev_err(&i2c->dev, "Reading frame register failed (%d)",
-				result);
-		} else if (buffer[0] == 255) {
-			// CRC mismatch, reset to inventory for next anti-collision sequence.
-			buffer[0] = 1;
-			buffer[1] = COMMAND_RESET_TO_INVENTORY;
-			result = i2c_smbus_write_i2c_block_data(
-				i2c, CRX14_IO_FRAME_REGISTER, 2, buffer);
-			if (result < 0) {
-				dev_err(&i2c->dev,
-					"Writing frame register failed (%d)",
-					result);
+	return READ_ONCE(priv->abort) ||
+	       (priority != priority_realtime && READ_ONCE(priv->preempt));
+}
+
+// Determine if a running command should stop between two frames.
+static bool cr14_command_cancelled(struct cr14_i2c_data *priv,
+				   struct cr14_command *cmd)
+{
+	return READ_ONCE(cmd->cancelled) ||
+	       cr14_session_cancelled(priv, cmd->priority);
+}
+
+// Add a UID to the chips found during current round.
+static void cr14_add_round_uid(struct cr14_i2c_data *priv, const u8 *uid)
+{
+	int ix;
+	for (ix = 0; ix < priv->round_count; ix++) {
+		if (memcmp(priv->round_uids[ix], uid, 8) == 0) {
+			return;
+		}
+	}
+	if (priv->round_count < ROUND_MAX_UIDS) {
+		memcpy(priv->round_uids[priv->round_count], uid, 8);
+		priv->round_count++;
+	}
+}
+
+// Write round summary to polling clients that requested it.
+static void cr14_process_round_summary(struct cr14_i2c_data *priv)
+{
+	struct cr14_client *client;
+	enum cr14_priority priority;
+	u8 *buffer = priv->round_message;
+	int len = 14 + (priv->round_count * 8);
+	buffer[0] = MESSAGE_ROUND_SUMMARY_HEADER;
+	put_unaligned_le32(priv->round_id, buffer + 1);
+	put_unaligned_le64(ktime_to_ns(priv->round_start), buffer + 5);
+	buffer[13] = priv->round_count;
+	memcpy(buffer + 14, priv->round_uids, priv->round_count * 8);
+
+	mutex_lock(&priv->command_lock);
+	for (priority = priority_realtime; priority < priority_classes_count;
+	     priority++) {
+		list_for_each_entry(client, &priv->clients, list) {
+			if (client->priority != priority ||
+			    !client->round_summary) {
+				continue;
+			}
+			if (client->mode == mode_poll_repeat ||
+			    (client->mode == mode_poll_once &&
+			     priv->round_count > 0)) {
+				cr14_write_to_device(client, len, buffer);
+			}
+			if (client->mode == mode_poll_once &&
+			    priv->round_count > 0) {
+				cr14_record_latency(priv, priority,
+						    client->poll_submitted);
+				client->mode = mode_idle;
+			}
+		}
+	}
+	mutex_unlock(&priv->command_lock);
+}
+
+// Determine chip model from its UID (see datasheets).
+static enum cr14_tag_model cr14_tag_model(const u8 *uid)
+{
+	if (uid[6] != UID_MANUFACTURER_ST) {
+		return CR14_MODEL_UNKNOWN;
+	}
+	// 8 bits product codes
+	switch (uid[5]) {
+	case 0x1B:
+		return CR14_MODEL_ST25TB512_AC;
+	case 0x1F:
+		return CR14_MODEL_ST25TB04K;
+	case 0x33:
+		return CR14_MODEL_ST25TB512_AT;
+	case 0x3F:
+		return CR14_MODEL_ST25TB02K;
+	}
+	// 6 bits product codes
+	switch (uid[5] >> 2) {
+	case 0x03:
+		return CR14_MODEL_SRIX4K;
+	case 0x06:
+		return CR14_MODEL_SRI512;
+	case 0x0C:
+		return CR14_MODEL_SRT512;
+	case 0x07:
+		return CR14_MODEL_SRI4K;
+	case 0x0F:
+		return CR14_MODEL_SRI2K;
+	}
+	return CR14_MODEL_UNKNOWN;
+}
+
+// Number of 32 bits blocks of the memory of each model.
+static const u8 cr14_tag_model_blocks[] = {
+	[CR14_MODEL_UNKNOWN] = 0,
+	[CR14_MODEL_SRIX4K] = 128,
+	[CR14_MODEL_SRI512] = 16,
+	[CR14_MODEL_SRT512] = 16,
+	[CR14_MODEL_SRI4K] = 128,
+	[CR14_MODEL_SRI2K] = 64,
+	[CR14_MODEL_ST25TB512_AC] = 16,
+	[CR14_MODEL_ST25TB04K] = 128,
+	[CR14_MODEL_ST25TB512_AT] = 16,
+	[CR14_MODEL_ST25TB02K] = 64,
+};
+
+// Find or add a chip in the table of present chips, and update its last seen
+// time. arrival is set if chip was added.
+// Return NULL if chip is not present and table is full.
+static struct cr14_tag *cr14_update_tag(struct cr14_i2c_data *priv,
+					const u8 *uid, ktime_t now,
+					bool *arrival)
+{
+	struct cr14_tag *tag;
+	int ix;
+	*arrival = false;
+	for (ix = 0; ix < priv->tags_count; ix++) {
+		tag = &priv->tags[ix];
+		if (memcmp(tag->uid, uid, 8) == 0) {
+			write_seqlock(&priv->tags_lock);
+			tag->last_seen = now;
+			write_sequnlock(&priv->tags_lock);
+			return tag;
+		}
+	}
+	if (priv->tags_count == MAX_PRESENT_TAGS) {
+		return NULL;
+	}
+	*arrival = true;
+	write_seqlock(&priv->tags_lock);
+	tag = &priv->tags[priv->tags_count];
+	memcpy(tag->uid, uid, 8);
+	tag->model = cr14_tag_model(uid);
+	tag->first_seen = now;
+	tag->last_seen = now;
+	tag->last_reported = 0;
+	memset(&tag->link, 0, sizeof(tag->link));
+	priv->tags_count++;
+	write_sequnlock(&priv->tags_lock);
+	return tag;
+}
+
+// Remove chips that were not seen during the round and for longer than the
+// dedup window.
+static void cr14_expire_tags(struct cr14_i2c_data *priv)
+{
+	ktime_t now = ktime_get();
+	ktime_t window = ms_to_ktime(READ_ONCE(priv->dedup_window_ms));
+	int ix = 0;
+	while (ix < priv->tags_count) {
+		struct cr14_tag *tag = &priv->tags[ix];
+		if (ktime_before(tag->last_seen, priv->round_start) &&
+		    ktime_after(ktime_sub(now, tag->last_seen), window)) {
+			cr14_notify_departure(priv, tag->uid, tag->model);
+			write_seqlock(&priv->tags_lock);
+			priv->tags_count--;
+			priv->tags[ix] = priv->tags[priv->tags_count];
+			write_sequnlock(&priv->tags_lock);
+		} else {
+			ix++;
+		}
+	}
+}
+
+// Empty the table of present chips, when polling stops.
+static void cr14_clear_tags(struct cr14_i2c_data *priv)
+{
+	int ix;
+	for (ix = 0; ix < priv->tags_count; ix++) {
+		cr14_notify_departure(priv, priv->tags[ix].uid,
+				      priv->tags[ix].model);
+	}
+	write_seqlock(&priv->tags_lock);
+	priv->tags_count = 0;
+	write_sequnlock(&priv->tags_lock);
+}
+
+// Account a frame exchange with the selected chip in its link statistics.
+static void cr14_link_account(struct cr14_i2c_data *priv,
+			      enum cr14_link_event event)
+{
+	struct cr14_tag *tag = priv->selected_tag;
+	if (!tag) {
+		return;
+	}
+	write_seqlock(&priv->tags_lock);
+	switch (event) {
+	case link_frame:
+		tag->link.frames++;
+		break;
+	case link_crc_error:
+		tag->link.crc_errors++;
+		break;
+	case link_no_response:
+		tag->link.no_response++;
+		break;
+	case link_collision:
+		tag->link.collisions++;
+		break;
+	case link_retry:
+		tag->link.retries++;
+		break;
+	}
+	write_sequnlock(&priv->tags_lock);
+}
+
+// Copy the table of present chips, without blocking the worker.
+// Return the number of chips.
+static int cr14_get_tags(struct cr14_i2c_data *priv,
+			 struct cr14_tag tags[MAX_PRESENT_TAGS])
+{
+	unsigned seq;
+	int count;
+	do {
+		seq = read_seqbegin(&priv->tags_lock);
+		count = READ_ONCE(priv->tags_count);
+		memcpy(tags, priv->tags, count * sizeof(struct cr14_tag));
+	} while (read_seqretry(&priv->tags_lock, seq));
+	return count;
+}
+
+// Determine if a UID should be reported to a client in poll repeat mode.
+static bool cr14_should_report_tag(struct cr14_i2c_data *priv,
+				   struct cr14_client *client,
+				   struct cr14_tag *tag, bool arrival,
+				   ktime_t now)
+{
+	unsigned int heartbeat_ms = READ_ONCE(priv->heartbeat_ms);
+	if (READ_ONCE(priv->dedup_window_ms) == 0 || arrival || tag == NULL) {
+		return true;
+	}
+	// Client started polling after chip was last reported.
+	if (ktime_before(tag->last_reported, client->poll_submitted)) {
+		return true;
+	}
+	return heartbeat_ms &&
+	       ktime_ms_delta(now, tag->last_reported) >= heartbeat_ms;
+}
+
+// Report UID to polling clients.
+// Return the chip in the table of present chips, or NULL if table is full.
+static struct cr14_tag *cr14_process_polling(struct cr14_i2c_data *priv,
+					     const u8 *uid)
+{
+	struct cr14_client *client;
+	enum cr14_priority priority;
+	struct cr14_tag *tag;
+	ktime_t now = ktime_get();
+	bool arrival;
+	bool reported = false;
+	u8 buffer[9];
+	buffer[0] = MESSAGE_UID_HEADER;
+	memcpy(buffer + 1, uid, sizeof(buffer) - 1);
+
+	atomic64_inc(&priv->stats.uids);
+	if (priv->round_count == 0) {
+		cr14_histogram_add(priv, histogram_time_to_uid,
+				   priv->rf_on_since);
+	}
+	cr14_add_round_uid(priv, uid);
+	tag = cr14_update_tag(priv, uid, now, &arrival);
+	if (arrival) {
+		cr14_notify_arrival(priv, uid, cr14_tag_model(uid));
+	}
+
+	mutex_lock(&priv->command_lock);
+	for (priority = priority_realtime; priority < priority_classes_count;
+	     priority++) {
+		list_for_each_entry(client, &priv->clients, list) {
+			if (client->priority != priority ||
+			    client->round_summary) {
+				continue;
 			}
-			// 1 byte: 651 usec + watchdog-timeout.
-			usleep_range(1200, 2000);
+			if (client->mode == mode_poll_once ||
+			    (client->mode == mode_poll_repeat &&
+			     cr14_should_report_tag(priv, client, tag, arrival,
+						    now))) {
+				cr14_write_to_device(client, sizeof(buffer),
+						     buffer);
+				reported = true;
+			}
+			if (client->mode == mode_poll_once) {
+				cr14_record_latency(priv, priority,
+						    client->poll_submitted);
+				client->mode = mode_idle;
+			}
+		}
+	}
+	mutex_unlock(&priv->command_lock);
+	if (reported && tag) {
+		tag->last_reported = now;
+	}
+	return tag;
+}
+
+static int cr14_write_block(struct cr14_i2c_data *priv, u8 addr,
+			    const u8 *data)
+{
+	s32 result;
+	u8 buffer[7];
+	ktime_t start = ktime_get();
+	buffer[0] = 6;
+	buffer[1] = COMMAND_WRITE_BLOCK_H;
+	buffer[2] = addr;
+	buffer[3] = data[0];
+	buffer[4] = data[1];
+	buffer[5] = data[2];
+	buffer[6] = data[3];
+	result = cr14_write_frame(priv, 7, buffer);
+	if (result >= 0) {
+		// 6 bytes + 7ms worst case (binary counter decrement)
+		cr14_wait(wait_write_block);
+		cr14_histogram_add(priv, histogram_write_block, start);
+		cr14_link_account(priv, link_frame);
+	}
+	return result;
+}
+
+// Return 0 on success.
+// 1 on collision
+// 2 if chip disappeared
+// negative value on error.
+static int cr14_read_block(struct cr14_i2c_data *priv, u8 addr, u8 *data)
+{
+	s32 result;
+	u8 buffer[5];
+	ktime_t start = ktime_get();
+	do {
+		buffer[0] = 2;
+		buffer[1] = COMMAND_READ_BLOCK_H;
+		buffer[2] = addr;
+		result = cr14_write_frame(priv, 3, buffer);
+		if (result < 0) {
+			break;
+		}
+		// 2 bytes, see below
+		cr14_wait(wait_two_bytes_frame);
+		result = cr14_read_frame(priv, 5, buffer);
+		if (result < 0) {
+			break;
+		}
+		if (buffer[0] == 255) {
+			cr14_reset_to_inventory(priv);
+			cr14_link_account(priv, link_crc_error);
 			result = 1;
 		} else if (buffer[0] == 0) {
 			// Chip did not reply, leave.
+			atomic64_inc(&priv->stats.no_response);
+			cr14_link_account(priv, link_no_response);
 			result = 2;
 		} else if (buffer[0] != 4) {
 			// Incoherent number of bytes
-			dev_err(&i2c->dev,
+			dev_err_ratelimited(
+				&priv->i2c->dev,
 				"Expected 4 bytes for read_block, got %d instead",
 				buffer[0]);
 		} else {
@@ -404,38 +1540,94 @@ static int cr14_read_block(struct i2c_client *i2c, u8 addr, u8 *data)
 			data[2] = buffer[3];
 			data[3] = buffer[4];
 			result = 0;
+			cr14_histogram_add(priv, histogram_read_block, start);
+			cr14_link_account(priv, link_frame);
 		}
-	}
+	} while (0);
 	return result;
 }
 
-static int cr14_process_command(struct cr14_i2c_data *priv)
+static u8 cr14_command_header(struct cr14_command *cmd)
 {
-	s32 result;
+	switch (cmd->mode) {
+	case mode_read_single_block:
+		return MESSAGE_READ_SINGLE_BLOCK_HEADER;
+	case mode_read_multiple_blocks:
+		return MESSAGE_READ_MULTIPLE_BLOCKS_HEADER;
+	case mode_write_single_block:
+		return MESSAGE_WRITE_SINGLE_BLOCK_HEADER;
+	case mode_write_multiple_blocks:
+		return MESSAGE_WRITE_MULTIPLE_BLOCKS_HEADER;
+	case mode_read_range:
+		return MESSAGE_READ_RANGE_HEADER;
+	case mode_write_range:
+		return MESSAGE_WRITE_RANGE_HEADER;
+	case mode_fill_range:
+		return MESSAGE_FILL_RANGE_HEADER;
+	default:
+		return 0;
+	}
+}
+
+static const u8 *cr14_command_chip_uid(struct cr14_command *cmd)
+{
+	const u8 *chip_uid;
+	switch (cmd->mode) {
+	case mode_read_single_block:
+		chip_uid = cmd->params.read_single_block.chip_uid;
+		break;
+	case mode_read_multiple_blocks:
+	case mode_read_range:
+		chip_uid = cmd->params.read_multiple_blocks.chip_uid;
+		break;
+	case mode_write_single_block:
+		chip_uid = cmd->params.write_single_block.chip_uid;
+		break;
+	case mode_write_multiple_blocks:
+	case mode_write_range:
+	case mode_fill_range:
+		chip_uid = cmd->params.write_multiple_blocks.chip_uid;
+		break;
+	default:
+		chip_uid = NULL;
+	}
+	return chip_uid;
+}
+
+// Return 0 if command was completed and its result was written to the client.
+// 1 on collision
+// -ECANCELED if command or session was cancelled
+// other values if command failed and should be retried.
+static int cr14_process_command(struct cr14_i2c_data *priv,
+				struct cr14_command *cmd)
+{
+	s32 result = 0;
 	int ix;
-	int collision = 0;
 	do {
-		if (priv->mode == mode_write_single_block) {
+		if (cmd->mode == mode_write_single_block) {
 			result = cr14_write_block(
-				priv->i2c,
-				priv->command_params.write_single_block.addr,
-				priv->command_params.write_single_block.data);
+				priv, cmd->params.write_single_block.addr,
+				cmd->params.write_single_block.data);
 			if (result < 0) {
 				break;
 			}
-		} else if (priv->mode == mode_write_multiple_blocks) {
+		} else if (cmd->mode == mode_write_multiple_blocks ||
+			   cmd->mode == mode_write_range ||
+			   cmd->mode == mode_fill_range) {
 			for (ix = 0;
-			     ix < priv->command_params.write_multiple_blocks
-					  .addresses_count;
+			     ix <
+			     cmd->params.write_multiple_blocks.addresses_count;
 			     ix++) {
-				u8 addr =
-					priv->command_params
-						.write_multiple_blocks.addr[ix];
-				u8 *data = priv->command_params
-						   .write_multiple_blocks.data +
-					   (ix * 4);
-				result =
-					cr14_write_block(priv->i2c, addr, data);
+				u8 addr = cmd->params.write_multiple_blocks
+						  .addr[ix];
+				u8 *data =
+					cmd->params.write_multiple_blocks.data +
+					(ix * 4);
+				if (cr14_command_cancelled(priv, cmd)) {
+					result = -ECANCELED;
+					break;
+				}
+				result = cr14_write_block(priv, addr, data);
 				if (result < 0) {
 					break;
 				}
@@ -444,137 +1636,185 @@ static int cr14_process_command(struct cr14_i2c_data *priv)
 				break;
 			}
 		}
-		if (priv->mode == mode_read_single_block ||
-		    priv->mode == mode_write_single_block) {
+		if (cmd->mode == mode_read_single_block ||
+		    cmd->mode == mode_write_single_block) {
 			u8 addr;
 			u8 buffer[5];
-			if (priv->mode == mode_read_single_block) {
-				addr = priv->command_params.read_single_block
-					       .addr;
+			if (cmd->mode == mode_read_single_block) {
+				addr = cmd->params.read_single_block.addr;
 			} else {
-				addr = priv->command_params.write_single_block
-					       .addr;
+				addr = cmd->params.write_single_block.addr;
 			}
-			result = cr14_read_block(priv->i2c, addr, buffer + 1);
+			result = cr14_read_block(priv, addr, buffer + 1);
 			if (result) {
-				if (result == 1) {
-					collision = 1;
-				}
 				break;
 			}
-			if (priv->mode == mode_read_single_block) {
-				buffer[0] = MESSAGE_READ_SINGLE_BLOCK_HEADER;
-			} else {
-				buffer[0] = MESSAGE_WRITE_SINGLE_BLOCK_HEADER;
-			}
-			cr14_write_to_device(priv, 5, buffer);
-			priv->mode = mode_idle;
+			buffer[0] = cr14_command_header(cmd);
+			result = cr14_write_response(priv, cmd, 5, buffer);
 		} else {
 			u8 *read_data;
 			u8 *addresses;
 			u8 addresses_count;
-			if (priv->mode == mode_read_multiple_blocks) {
-				addresses = priv->command_params
-						    .read_multiple_blocks.addr;
-				addresses_count = priv->command_params
-							  .read_multiple_blocks
+			if (cmd->mode == mode_read_multiple_blocks ||
+			    cmd->mode == mode_read_range) {
+				addresses = cmd->params.read_multiple_blocks.addr;
+				addresses_count = cmd->params.read_multiple_blocks
 							  .addresses_count;
 			} else {
-				addresses = priv->command_params
-						    .write_multiple_blocks.addr;
-				addresses_count = priv->command_params
-							  .write_multiple_blocks
-							  .addresses_count;
-			}
-			read_data = devm_kzalloc(&priv->i2c->dev,
-						 2 + (addresses_count * 4),
-						 GFP_KERNEL);
-			if (!read_data) {
-				result = -ENOMEM;
-				break;
+				addresses =
+					cmd->params.write_multiple_blocks.addr;
+				addresses_count =
+					cmd->params.write_multiple_blocks
+						.addresses_count;
 			}
+			read_data = priv->response;
 			result = 0;
 			for (ix = 0; ix < addresses_count; ix++) {
+				if (cr14_command_cancelled(priv, cmd)) {
+					result = -ECANCELED;
+					break;
+				}
 				result = cr14_read_block(
-					priv->i2c, addresses[ix],
+					priv, addresses[ix],
 					read_data + 2 + (4 * ix));
 				if (result) {
-					if (result == 1) {
-						collision = 1;
-					}
 					break;
 				}
 			}
 			if (result) {
-				devm_kfree(&priv->i2c->dev, read_data);
 				break;
 			}
-			if (priv->mode == mode_read_multiple_blocks) {
-				read_data[0] =
-					MESSAGE_READ_MULTIPLE_BLOCKS_HEADER;
+			read_data[0] = cr14_command_header(cmd);
+			if (cmd->mode == mode_write_range ||
+			    cmd->mode == mode_fill_range) {
+				// Status: number of mismatching blocks.
+				u8 *data = cmd->params.write_multiple_blocks.data;
+				read_data[1] = 0;
+				for (ix = 0; ix < addresses_count; ix++) {
+					if (memcmp(read_data + 2 + (4 * ix),
+						   data + (4 * ix), 4) != 0) {
+						read_data[1]++;
+					}
+				}
+				result = cr14_write_response(priv, cmd, 2,
+							     read_data);
 			} else {
-				read_data[0] =
-					MESSAGE_WRITE_MULTIPLE_BLOCKS_HEADER;
+				read_data[1] = addresses_count;
+				result = cr14_write_response(
+					priv, cmd, 2 + (addresses_count * 4),
+					read_data);
 			}
-			read_data[1] = addresses_count;
-			cr14_write_to_device(priv, 2 + (addresses_count * 4),
-					     read_data);
-			priv->mode = mode_idle;
-			devm_kfree(&priv->i2c->dev, read_data);
 		}
 	} while (false);
+	if (result < 0 && result != -ECANCELED) {
+		result = 2;
+	}
+	return result;
+}
+
+// Account a command whose response was written and free it.
+static void cr14_complete_command(struct cr14_i2c_data *priv,
+				  struct cr14_command *cmd)
+{
+	atomic64_inc(&priv->stats.commands_completed);
+	cr14_notify_command(priv, cr14_command_chip_uid(cmd),
+			    cr14_command_header(cmd), 0);
+	cr14_histogram_add(priv,
+			   histogram_read_single_block_command +
+				   (cmd->mode - mode_read_single_block),
+			   cmd->submitted);
+	mutex_lock(&priv->command_lock);
+	cr14_record_latency(priv, cmd->priority, cmd->submitted);
+	list_del(&cmd->list);
+	cr14_free_command(cmd);
+	mutex_unlock(&priv->command_lock);
+}
+
+// Run every command of the session batch targeting the selected chip.
+// Batch is only modified by the worker, with command_lock held.
+static int cr14_process_batch(struct cr14_i2c_data *priv, const u8 *uid)
+{
+	struct cr14_command *cmd, *tmp;
+	int collision = 0;
+	list_for_each_entry_safe(cmd, tmp, &priv->batch, list) {
+		const u8 *chip_uid = cr14_command_chip_uid(cmd);
+		int result;
+		if (cr14_session_cancelled(priv, cmd->priority)) {
+			break;
+		}
+		if (READ_ONCE(cmd->cancelled) || chip_uid == NULL ||
+		    memcmp(chip_uid, uid, 8) != 0) {
+			continue;
+		}
+		trace_cr14_command_dispatch(cr14_command_header(cmd), chip_uid,
+					    cmd->priority);
+		result = cr14_process_command(priv, cmd);
+		if (result == -ECANCELED) {
+			// Not a link failure: cancelled commands are freed,
+			// commands of a cancelled session run in next one.
+			if (READ_ONCE(cmd->cancelled)) {
+				mutex_lock(&priv->command_lock);
+				cr14_cancel_command(priv, cmd);
+				mutex_unlock(&priv->command_lock);
+			}
+			continue;
+		}
+		trace_cr14_command_complete(cr14_command_header(cmd), chip_uid,
+					    result);
+		if (result != 0) {
+			atomic64_inc(&priv->stats.commands_retried);
+			cr14_link_account(priv, link_retry);
+		}
+		if (result == 0) {
+			cr14_complete_command(priv, cmd);
+		} else if (result == 1) {
+			collision = 1;
+			break;
+		}
+	}
 	return collision;
 }
 
-static int cr14_get_uid_and_process_mode(struct cr14_i2c_data *priv, u8 chip_id)
+// Select a chip, read its UID and run polling and commands.
+// slotted is true if chip was found with slot markers, after a collision.
+static int cr14_get_uid_and_process_mode(struct cr14_i2c_data *priv,
+					 u8 chip_id, bool slotted)
 {
 	u8 buffer[9];
 	s32 result;
 	int collision = 0;
+	ktime_t start = ktime_get();
 	do {
 		buffer[0] = 2;
 		buffer[1] = COMMAND_SELECT_H;
 		buffer[2] = chip_id;
-		result = i2c_smbus_write_i2c_block_data(
-			priv->i2c, CRX14_IO_FRAME_REGISTER, 3, buffer);
+		result = cr14_write_frame(priv, 3, buffer);
 		if (result < 0) {
-			dev_err(&priv->i2c->dev,
-				"Writing frame register failed (%d)", result);
 			break;
 		}
 		// 2 bytes, see below
-		usleep_range(1250, 2000);
-		result = cr14_read_io_frame_register(priv->i2c, 2, buffer);
+		cr14_wait(wait_two_bytes_frame);
+		result = cr14_read_frame(priv, 2, buffer);
 		if (result < 0) {
-			dev_err(&priv->i2c->dev,
-				"Reading frame register failed (%d)", result);
 			break;
 		} else if (buffer[0] == 255) {
-			// CRC mismatch, reset to inventory for next anti-collision sequence.
-			buffer[0] = 1;
-			buffer[1] = COMMAND_RESET_TO_INVENTORY;
-			result = i2c_smbus_write_i2c_block_data(
-				priv->i2c, CRX14_IO_FRAME_REGISTER, 2, buffer);
-			if (result < 0) {
-				dev_err(&priv->i2c->dev,
-					"Writing frame register failed (%d)",
-					result);
-			}
-			// 1 byte: 651 usec + watchdog-timeout.
-			usleep_range(1200, 2000);
+			cr14_reset_to_inventory(priv);
 			collision = 1;
 			break;
 		} else if (buffer[0] == 0) {
 			// Chip did not reply, leave.
+			atomic64_inc(&priv->stats.no_response);
 			break;
 		} else if (buffer[0] != 1) {
 			// CR14 didn't send the len as first byte
-			dev_err(&priv->i2c->dev,
+			dev_err_ratelimited(
+				&priv->i2c->dev,
 				"Select did not return a single byte, first byte is %d",
 				buffer[0]);
 			break;
 		} else if (buffer[1] != chip_id) {
-			dev_err(&priv->i2c->dev,
+			dev_err_ratelimited(
+				&priv->i2c->dev,
 				"Select did not return the chip_id (%d, chip_id = %d)",
 				buffer[1], chip_id);
 			break;
@@ -582,185 +1822,425 @@ static int cr14_get_uid_and_process_mode(struct cr14_i2c_data *priv, u8 chip_id)
 			// Select succeeded.
 			buffer[0] = 1;
 			buffer[1] = COMMAND_GET_UID;
-			result = i2c_smbus_write_i2c_block_data(
-				priv->i2c, CRX14_IO_FRAME_REGISTER, 2, buffer);
+			result = cr14_write_frame(priv, 2, buffer);
 			if (result < 0) {
-				dev_err(&priv->i2c->dev,
-					"Writing frame register failed (%d)",
-					result);
 				break;
 			}
 			// We expect the PICC to write the result, which is 8 bytes (+ CRC)
 			// Default case is therefore longer than timeout.
 			// 10 bytes => 100 ETU
 			// SOF & EOF => 26 ETU
-			usleep_range(1900, 5000);
+			cr14_wait(wait_get_uid);
 
-			result = cr14_read_io_frame_register(priv->i2c, 9,
-							     buffer);
+			result = cr14_read_frame(priv, 9, buffer);
 			if (result < 0) {
-				dev_err(&priv->i2c->dev,
-					"Reading frame register failed (%d)",
-					result);
 				break;
 			}
 			if (buffer[0] == 255) {
-				// CRC mismatch, reset to inventory for next anti-collision sequence, if any.
-				buffer[0] = 1;
-				buffer[1] = COMMAND_RESET_TO_INVENTORY;
-				result = i2c_smbus_write_i2c_block_data(
-					priv->i2c, CRX14_IO_FRAME_REGISTER, 2,
-					buffer);
-				if (result < 0) {
-					dev_err(&priv->i2c->dev,
-						"Writing frame register failed (%d)",
-						result);
-				}
-				// 1 byte: 651 usec + watchdog-timeout.
-				usleep_range(1200, 2000);
+				cr14_reset_to_inventory(priv);
 				collision = 1;
 				break;
 			}
 			if (buffer[0] != 8) {
-				dev_err(&priv->i2c->dev,
+				dev_err_ratelimited(
+					&priv->i2c->dev,
 					"UID length mismatch, expected 8 bytes, first byte is %d",
 					buffer[0]);
 				break;
 			}
+			cr14_histogram_add(priv, histogram_select_to_uid,
+					   start);
 
-			// Process UID depending on mode.
-			if (priv->mode == mode_poll_once ||
-			    priv->mode == mode_poll_repeat) {
-				cr14_process_polling(priv, buffer + 1);
-			} else if (priv->mode != mode_idle) {
-				// Check if UID matches.
-				const u8 *chip_uid;
-				switch (priv->mode) {
-				case mode_read_single_block:
-					chip_uid = priv->command_params
-							   .read_single_block
-							   .chip_uid;
-					break;
-				case mode_read_multiple_blocks:
-					chip_uid = priv->command_params
-							   .read_multiple_blocks
-							   .chip_uid;
-					break;
-				case mode_write_single_block:
-					chip_uid = priv->command_params
-							   .write_single_block
-							   .chip_uid;
-					break;
-				case mode_write_multiple_blocks:
-					chip_uid =
-						priv->command_params
-							.write_multiple_blocks
-							.chip_uid;
-					break;
-				default:
-					chip_uid = NULL;
-				}
-				if (chip_uid != NULL &&
-				    memcmp(chip_uid, buffer + 1, 8) == 0) {
-					if (cr14_process_command(priv)) {
-						collision = 1;
-					}
-				}
-			} else {
-				dev_err(&priv->i2c->dev, "Unknown mode (%d)",
-					priv->mode);
+			// Report UID to polling clients and process commands
+			// targeting this chip.
+			priv->selected_tag = cr14_process_polling(priv, buffer + 1);
+			if (slotted) {
+				cr14_link_account(priv, link_collision);
+			}
+			if (cr14_process_batch(priv, buffer + 1)) {
+				collision = 1;
 			}
+			priv->selected_tag = NULL;
 
 			// Send completion command: chip will no longer participate in
 			// anti-collision protocol
 			buffer[0] = 1;
 			buffer[1] = COMMAND_COMPLETION;
-			result = i2c_smbus_write_i2c_block_data(
-				priv->i2c, CRX14_IO_FRAME_REGISTER, 2, buffer);
-			if (result < 0) {
-				dev_err(&priv->i2c->dev,
-					"Writing frame register failed (%d)",
-					result);
-			}
+			cr14_write_frame(priv, 2, buffer);
 			// 1 byte, see above.
-			usleep_range(1200, 2000);
+			cr14_wait(wait_one_byte_frame);
 		}
 	} while (0);
 	return collision;
 }
 
-static void cr14_do_poll(struct work_struct *work)
+// ========================================================================== //
+// Scheduling
+// ========================================================================== //
+
+// Free a command and release its reference on the client.
+// Called with command_lock held.
+static void cr14_free_command(struct cr14_command *cmd)
 {
-	struct cr14_i2c_data *priv =
-		container_of(work, struct cr14_i2c_data, polling_work);
-	// Copy mode and params to the stack.
-	s32 result;
-	u8 buffer[36];
-	u8 value;
-	int collision;
+	struct cr14_client *client = cmd->client;
+	client->queued_commands--;
+	wake_up_interruptible(&client->write_wq);
+	mempool_free(cmd, client->priv->command_pool);
+	kref_put(&client->kref, cr14_client_release);
+}
 
-	mutex_lock(&priv->command_lock);
-	if (priv->mode == mode_idle) {
-		mutex_unlock(&priv->command_lock);
-		return;
+// Account a cancelled command and free it.
+// Called with command_lock held.
+static void cr14_cancel_command(struct cr14_i2c_data *priv,
+				struct cr14_command *cmd)
+{
+	atomic64_inc(&priv->stats.commands_cancelled);
+	trace_cr14_command_complete(cr14_command_header(cmd),
+				    cr14_command_chip_uid(cmd), -ECANCELED);
+	cr14_notify_command(priv, cr14_command_chip_uid(cmd),
+			    cr14_command_header(cmd), -ECANCELED);
+	list_del(&cmd->list);
+	cr14_free_command(cmd);
+}
+
+// Cancel every command queued or running for a client.
+// Called with command_lock held.
+static void cr14_cancel_commands(struct cr14_i2c_data *priv,
+				 struct cr14_client *client)
+{
+	struct cr14_command *cmd, *tmp;
+	list_for_each_entry_safe(cmd, tmp, &client->commands, list) {
+		cr14_cancel_command(priv, cmd);
+	}
+	// Commands of the current session are freed by the worker.
+	list_for_each_entry(cmd, &priv->batch, list) {
+		if (cmd->client == client) {
+			WRITE_ONCE(cmd->cancelled, true);
+		}
 	}
+}
 
-	do {
-		// Turn RF on.
-		value = CARRIER_FREQ_RF_OUT_ON | WATCHDOG_TIMEOUT_5US;
-		result = cr14_write_register_byte_check(
-			priv->i2c, CRX14_PARAMETER_REGISTER, value);
-		if (result < 0) {
-			dev_err(&priv->i2c->dev, "Turning RF on failed (%d)",
-				result);
-			break;
+// Determine if any client needs an RF session, either because it is polling
+// or because it has pending commands.
+// Called with command_lock held.
+static bool cr14_needs_polling(struct cr14_i2c_data *priv)
+{
+	struct cr14_client *client;
+	list_for_each_entry(client, &priv->clients, list) {
+		if (client->mode != mode_idle ||
+		    !list_empty(&client->commands)) {
+			return true;
 		}
+	}
+	return false;
+}
 
-		buffer[0] = 2;
-		buffer[1] = COMMAND_INITIATE_H;
-		buffer[2] = COMMAND_INITIATE_L;
-		result = i2c_smbus_write_i2c_block_data(
-			priv->i2c, CRX14_IO_FRAME_REGISTER, 3, buffer);
-		if (result < 0) {
-			dev_err(&priv->i2c->dev,
-				"Writing frame register failed (%d)", result);
-			break;
+// Determine if any client has pending commands.
+// Called with command_lock held.
+static bool cr14_has_commands(struct cr14_i2c_data *priv)
+{
+	struct cr14_client *client;
+	list_for_each_entry(client, &priv->clients, list) {
+		if (!list_empty(&client->commands)) {
+			return true;
 		}
-		// After each write to the frame register, we need to wait for the CR14
-		// to send the command and wait for the result.
-		// We will perform busy polling as described in the datasheet.
-		// However, we know we can wait a minium time based on the number of
-		// sent or expected bytes.
-		// Time to send two bytes is 745 usec (61 ETU + t0 + t1 wait times)
-		// Watch-dog timeout is 500 usec.
-		// => wait at least 1250 usec.
-		usleep_range(1250, 2000);
+	}
+	return false;
+}
 
-		result = cr14_read_io_frame_register(priv->i2c, 2, buffer);
-		if (result < 0) {
-			dev_err(&priv->i2c->dev,
-				"Reading frame register failed (%d)", result);
-			break;
+// Abort current session, if any, when no client needs it anymore.
+// Session will stop at next frame and turn RF off.
+// Called with command_lock held.
+static void cr14_abort_session_if_unneeded(struct cr14_i2c_data *priv)
+{
+	if (!cr14_needs_polling(priv)) {
+		WRITE_ONCE(priv->abort, true);
+	}
+}
+
+// Move the first queued command of each client to the session batch, by
+// decreasing priority. Clients list is then rotated so the next session starts
+// with the next client (round-robin within each class).
+// Return the highest priority of the session, including polling.
+// Called with command_lock held.
+static enum cr14_priority cr14_schedule_batch(struct cr14_i2c_data *priv)
+{
+	struct cr14_client *client;
+	enum cr14_priority priority;
+	enum cr14_priority session_priority = priority_background;
+	for (priority = priority_realtime; priority < priority_classes_count;
+	     priority++) {
+		list_for_each_entry(client, &priv->clients, list) {
+			struct cr14_command *cmd = list_first_entry_or_null(
+				&client->commands, struct cr14_command, list);
+			if (cmd && cmd->priority == priority) {
+				list_move_tail(&cmd->list, &priv->batch);
+				session_priority =
+					min(session_priority, priority);
+			}
+			if (client->mode != mode_idle &&
+			    client->priority == priority) {
+				session_priority =
+					min(session_priority, priority);
+			}
 		}
-		if (buffer[0] == 255) {
-			collision = 1;
+	}
+	if (!list_empty(&priv->clients)) {
+		list_rotate_left(&priv->clients);
+	}
+	priv->preempt = false;
+	priv->abort = false;
+	return session_priority;
+}
+
+// Put commands of the session that did not complete back at the head of
+// their client queue, unless they were cancelled.
+// Called with command_lock held.
+static void cr14_requeue_batch(struct cr14_i2c_data *priv)
+{
+	struct cr14_command *cmd, *tmp;
+	list_for_each_entry_safe_reverse(cmd, tmp, &priv->batch, list) {
+		if (cmd->cancelled || cmd->client->closed) {
+			cr14_cancel_command(priv, cmd);
 		} else {
-			collision = 0;
+			list_move(&cmd->list, &cmd->client->commands);
 		}
+	}
+}
 
-		priv->running_command = 1; // lock mode & params
-		do {
-			if (collision) {
-				u16 mask;
-				int ix;
+// Put commands of the session that did not complete back in their queues and
+// determine the delay before next session. Sessions run back to back while
+// they complete commands and other commands are queued, so that pipelined
+// commands are not each delayed by the polling period. commands_completed is
+// the value of the counter when the session started.
+// Return whether another session is needed.
+static bool cr14_end_batch(struct cr14_i2c_data *priv, s64 commands_completed,
+			   unsigned long *delay)
+{
+	bool needs_polling;
+	bool back_to_back;
+	mutex_lock(&priv->command_lock);
+	cr14_requeue_batch(priv);
+	needs_polling = cr14_needs_polling(priv);
+	back_to_back =
+		cr14_has_commands(priv) &&
+		atomic64_read(&priv->stats.commands_completed) !=
+			commands_completed;
+	mutex_unlock(&priv->command_lock);
+	*delay = cr14_polling_delay(priv, back_to_back);
+	return needs_polling;
+}
 
-				collision = 0;
-				result = i2c_smbus_write_byte(
-					priv->i2c, CRX14_SLOT_MARKER_REGISTER);
+// ========================================================================== //
+// Fault recovery
+// ========================================================================== //
+
+// After RECOVERY_FAULT_THRESHOLD consecutive sessions failed on I2C errors,
+// sessions are replaced by recovery attempts until the CR14 answers again.
+// Clients and their queued commands are kept, commands of failed sessions
+// were put back in their queues and run once the CR14 is recovered.
+
+// Account the outcome of a session.
+static void cr14_session_fault(struct cr14_i2c_data *priv, bool faulted)
+{
+	if (!faulted) {
+		priv->faults = 0;
+		return;
+	}
+	priv->faults++;
+	if (priv->faults >= RECOVERY_FAULT_THRESHOLD && !priv->recovering) {
+		dev_warn(&priv->i2c->dev,
+			 "%d consecutive sessions failed, recovering CR14",
+			 priv->faults);
+		priv->recovering = true;
+		priv->recovery_attempts = 0;
+	}
+}
+
+// Recover the I2C bus if the adapter supports it, make sure the CR14 answers
+// and restore its configuration (RF off until next session).
+// Return 0 if recovered, or delay in jiffies before next attempt.
+static unsigned long cr14_recover(struct cr14_i2c_data *priv)
+{
+	struct i2c_adapter *adapter = priv->i2c->adapter;
+	struct device *dev = &priv->i2c->dev;
+	unsigned int delay_ms;
+	s32 result;
+
+	if (adapter->bus_recovery_info) {
+		// Recovery drives SCL, other users of the bus must wait.
+		i2c_lock_bus(adapter, I2C_LOCK_ROOT_ADAPTER);
+		result = i2c_recover_bus(adapter);
+		i2c_unlock_bus(adapter, I2C_LOCK_ROOT_ADAPTER);
+		if (result < 0) {
+			dev_err_ratelimited(dev, "I2C bus recovery failed (%d)",
+					    result);
+		}
+	}
+	do {
+		// Resume fails if CR14 does not answer.
+		result = pm_runtime_get_sync(dev);
+		if (result < 0) {
+			break;
+		}
+		// Same checks as probe.
+		result = i2c_smbus_read_byte_data(priv->i2c,
+						  CRX14_PARAMETER_REGISTER);
+		if (result < 0) {
+			break;
+		}
+		result = i2c_smbus_read_byte_data(
+			priv->i2c, ST25R_IDENTIFICATION_REGISTER);
+		if (result >= 0) {
+			result = -ENODEV;
+			break;
+		}
+		result = cr14_write_register_byte_check(
+			priv, CRX14_PARAMETER_REGISTER,
+			CARRIER_FREQ_RF_OUT_OFF | WATCHDOG_TIMEOUT_5US);
+	} while (0);
+	pm_runtime_mark_last_busy(dev);
+	pm_runtime_put_autosuspend(dev);
+
+	if (result < 0) {
+		atomic64_inc(&priv->stats.recovery_failures);
+		delay_ms = RECOVERY_RETRY_MS << min(priv->recovery_attempts, 4);
+		delay_ms = min(delay_ms, (unsigned int)RECOVERY_MAX_RETRY_MS);
+		priv->recovery_attempts++;
+		dev_err_ratelimited(dev,
+				    "CR14 recovery failed (%d), retrying in %u ms",
+				    result, delay_ms);
+		return msecs_to_jiffies(delay_ms);
+	}
+
+	atomic64_inc(&priv->stats.recoveries);
+	dev_info(dev, "CR14 recovered after %d attempts",
+		 priv->recovery_attempts + 1);
+	priv->recovering = false;
+	priv->faults = 0;
+	return 0;
+}
+
+// ========================================================================== //
+// RF session
+// ========================================================================== //
+
+static void cr14_do_poll(struct work_struct *work)
+{
+	struct cr14_i2c_data *priv =
+		container_of(work, struct cr14_i2c_data, polling_work);
+	s32 result;
+	u8 buffer[36];
+	int collision;
+	bool needs_polling;
+	bool round_complete = false;
+	enum cr14_priority session_priority;
+	struct device *dev = &priv->i2c->dev;
+	unsigned long delay;
+	bool powered;
+	bool suppressed;
+	bool rf_failed = false;
+	s64 i2c_errors;
+	s64 commands_completed;
+
+	if (READ_ONCE(priv->suspended) || READ_ONCE(priv->calibrating)) {
+		return;
+	}
+	if (priv->recovering) {
+		delay = cr14_recover(priv);
+		if (delay) {
+			restart_polling_timer(priv, delay);
+			return;
+		}
+	}
+	// Trigger interrupt restarts polling.
+	suppressed = cr14_polling_suppressed(priv);
+	mutex_lock(&priv->command_lock);
+	// Checked again with command_lock held, as they are set with abort:
+	// cr14_schedule_batch must not reset abort once they are set.
+	if (priv->suspended || priv->calibrating) {
+		mutex_unlock(&priv->command_lock);
+		return;
+	}
+	if (!cr14_needs_polling(priv) ||
+	    (suppressed && !cr14_has_commands(priv))) {
+		mutex_unlock(&priv->command_lock);
+		// No round will expire chips until polling resumes.
+		cr14_clear_tags(priv);
+		return;
+	}
+	session_priority = cr14_schedule_batch(priv);
+	delay = cr14_budget_delay(priv, session_priority);
+	if (delay) {
+		cr14_requeue_batch(priv);
+		mutex_unlock(&priv->command_lock);
+		atomic64_inc(&priv->stats.budget_deferrals);
+		restart_polling_timer(priv, delay);
+		return;
+	}
+	mutex_unlock(&priv->command_lock);
+
+	powered = pm_runtime_get_sync(dev) >= 0;
+	i2c_errors = atomic64_read(&priv->stats.i2c_errors);
+	commands_completed = atomic64_read(&priv->stats.commands_completed);
+
+	priv->round_id++;
+	priv->round_start = ktime_get();
+	priv->round_count = 0;
+	atomic64_inc(&priv->stats.rounds);
+	trace_cr14_session_start(priv->round_id, session_priority);
+
+	do {
+		if (!powered) {
+			dev_err_ratelimited(dev, "Resuming device failed");
+			break;
+		}
+		result = cr14_set_rf(priv, true);
+		if (result < 0) {
+			rf_failed = true;
+			break;
+		}
+
+		buffer[0] = 2;
+		buffer[1] = COMMAND_INITIATE_H;
+		buffer[2] = COMMAND_INITIATE_L;
+		result = cr14_write_frame(priv, 3, buffer);
+		if (result < 0) {
+			break;
+		}
+		// After each write to the frame register, we need to wait for the CR14
+		// to send the command and wait for the result.
+		// We will perform busy polling as described in the datasheet.
+		// However, we know we can wait a minium time based on the number of
+		// sent or expected bytes.
+		// Time to send two bytes is 745 usec (61 ETU + t0 + t1 wait times)
+		// Watch-dog timeout is 500 usec.
+		// => wait at least 1250 usec.
+		cr14_wait(wait_two_bytes_frame);
+
+		result = cr14_read_frame(priv, 2, buffer);
+		if (result < 0) {
+			break;
+		}
+		if (buffer[0] == 255) {
+			collision = 1;
+		} else {
+			collision = 0;
+		}
+
+		do {
+			round_complete = false;
+			if (cr14_session_cancelled(priv, session_priority)) {
+				break;
+			}
+			if (collision) {
+				u16 mask;
+				int ix;
+
+				collision = 0;
+				atomic64_inc(&priv->stats.collisions);
+				result = cr14_write_slot_marker(priv);
 				if (result < 0) {
-					dev_err(&priv->i2c->dev,
-						"Writing slot marker register failed (%d)",
-						result);
 					break;
 				}
 				// Wait much longer here:
@@ -768,18 +2248,15 @@ static void cr14_do_poll(struct work_struct *work)
 				// 16 SOF & 16 EOF => 336 ETU
 				// 16 watch-dog timeouts => 8000 usec
 				// at least 16000 usecs
-				usleep_range(16000, 20000);
+				cr14_wait(wait_slots);
 
-				result = cr14_read_io_frame_register(
-					priv->i2c, 19, buffer);
+				result = cr14_read_frame(priv, 19, buffer);
 				if (result < 0) {
-					dev_err(&priv->i2c->dev,
-						"Reading frame register failed (%d)",
-						result);
 					break;
 				}
 				if (buffer[0] != 18) {
-					dev_err(&priv->i2c->dev,
+					dev_err_ratelimited(
+						&priv->i2c->dev,
 						"Slot marker did not return 18 bytes, first byte is %d",
 						buffer[0]);
 					break;
@@ -787,10 +2264,16 @@ static void cr14_do_poll(struct work_struct *work)
 				mask = (buffer[2] << 8) | buffer[1];
 				ix = 0;
 				for (ix = 0; ix < 16; ix++) {
+					if (cr14_session_cancelled(
+						    priv, session_priority)) {
+						// Leave other chips to next session
+						collision = 0;
+						break;
+					}
 					if (mask & 0x0001) {
 						u8 chip_id = buffer[ix + 3];
 						if (cr14_get_uid_and_process_mode(
-							    priv, chip_id)) {
+							    priv, chip_id, true)) {
 							collision = 1;
 						}
 					} else if (buffer[ix + 3] == 0xFF) {
@@ -798,336 +2281,1593 @@ static void cr14_do_poll(struct work_struct *work)
 					}
 					mask >>= 1;
 				}
-			} else {
+			} else if (buffer[0] != 0) {
 				// A single PICC returned its id.
-				if (cr14_get_uid_and_process_mode(priv,
-								  buffer[1])) {
+				if (cr14_get_uid_and_process_mode(
+					    priv, buffer[1], false)) {
 					// In case of CRC error, retry with the slot marker route
 					collision = 1;
 				}
 			}
+			round_complete =
+				!cr14_session_cancelled(priv, session_priority);
 		} while (collision != 0);
 	} while (0);
 
-	priv->running_command = 0; // unlock mode & params
-	wake_up_interruptible(&priv->write_wq);
+	if (round_complete) {
+		cr14_expire_tags(priv);
+		cr14_process_round_summary(priv);
+	}
+
+	needs_polling = cr14_end_batch(priv, commands_completed, &delay);
+	if (!needs_polling) {
+		cr14_clear_tags(priv);
+	}
+
+	if (powered) {
+		cr14_set_rf(priv, false);
+	}
+	cr14_session_fault(priv,
+			   !powered || rf_failed ||
+				   atomic64_read(&priv->stats.i2c_errors) !=
+					   i2c_errors);
+	pm_runtime_mark_last_busy(dev);
+	pm_runtime_put_autosuspend(dev);
+	trace_cr14_session_end(priv->round_id, round_complete,
+			       priv->round_count);
+
+	if (needs_polling) {
+		restart_polling_timer(priv, delay);
+	}
+}
+
+static void cr14_polling_timer_cb(struct timer_list *t)
+{
+	struct cr14_i2c_data *priv = from_timer(priv, t, polling_timer);
+	if (READ_ONCE(priv->clients_count) && !READ_ONCE(priv->suspended)) {
+		schedule_work(&priv->polling_work);
+	}
+}
+
+static void restart_polling_timer(struct cr14_i2c_data *priv,
+				  unsigned long delay)
+{
+	del_timer_sync(&priv->polling_timer);
+	mod_timer(&priv->polling_timer, jiffies + delay);
+}
+
+static void stop_polling_timer(struct cr14_i2c_data *priv)
+{
+	del_timer_sync(&priv->polling_timer);
+}
+
+static void trigger_polling_work(struct cr14_i2c_data *priv)
+{
+	del_timer_sync(&priv->polling_timer);
+	if (READ_ONCE(priv->clients_count) && !READ_ONCE(priv->suspended)) {
+		schedule_work(&priv->polling_work);
+	}
+}
+
+// ========================================================================== //
+// Trigger input
+// ========================================================================== //
+
+static irqreturn_t cr14_trigger_irq(int irq, void *data)
+{
+	struct cr14_i2c_data *priv = data;
+	if (gpiod_get_value_cansleep(priv->trigger_gpio) > 0) {
+		WRITE_ONCE(priv->burst_end,
+			   jiffies + msecs_to_jiffies(TRIGGER_BURST_MS));
+		trigger_polling_work(priv);
+	}
+	return IRQ_HANDLED;
+}
+
+static int cr14_trigger_init(struct cr14_i2c_data *priv)
+{
+	struct device *dev = &priv->i2c->dev;
+	struct gpio_desc *gpio;
+	int irq;
+	int err;
+
+	gpio = devm_gpiod_get_optional(dev, "trigger", GPIOD_IN);
+	if (IS_ERR(gpio)) {
+		return PTR_ERR(gpio);
+	}
+	if (!gpio) {
+		return 0;
+	}
+	irq = gpiod_to_irq(gpio);
+	if (irq < 0) {
+		return irq;
+	}
+	priv->trigger_gpio = gpio;
+	priv->trigger_suppress =
+		device_property_read_bool(dev, "trigger-suppress-polling");
+	err = devm_request_threaded_irq(dev, irq, NULL, cr14_trigger_irq,
+					IRQF_TRIGGER_RISING |
+						IRQF_TRIGGER_FALLING |
+						IRQF_ONESHOT,
+					DRV_NAME, priv);
+	if (err) {
+		priv->trigger_gpio = NULL;
+		priv->trigger_suppress = false;
+	}
+	return err;
+}
+
+// ========================================================================== //
+// File operations & commands
+// ========================================================================== //
+
+static void cr14_client_release(struct kref *kref)
+{
+	struct cr14_client *client =
+		container_of(kref, struct cr14_client, kref);
+	kfree(client);
+}
+
+// Allocate a client and add it to the clients of the reader.
+static struct cr14_client *cr14_client_create(struct cr14_i2c_data *priv,
+					      enum cr14_mode mode,
+					      enum cr14_priority priority)
+{
+	struct cr14_client *client;
+
+	client = kzalloc(sizeof(*client), GFP_KERNEL);
+	if (!client) {
+		return NULL;
+	}
+	client->priv = priv;
+	kref_init(&client->kref);
+	spin_lock_init(&client->producer_lock);
+	mutex_init(&client->consumer_lock);
+	init_waitqueue_head(&client->read_wq);
+	init_waitqueue_head(&client->write_wq);
+	INIT_LIST_HEAD(&client->commands);
+	client->mode = mode;
+	client->priority = priority;
+	client->poll_submitted = ktime_get();
+
+	mutex_lock(&priv->command_lock);
+	list_add_tail(&client->list, &priv->clients);
+	WRITE_ONCE(priv->clients_count, priv->clients_count + 1);
 	mutex_unlock(&priv->command_lock);
 
-	value = CARRIER_FREQ_RF_OUT_OFF | WATCHDOG_TIMEOUT_5US;
-	result = i2c_smbus_write_byte_data(priv->i2c, CRX14_PARAMETER_REGISTER,
-					   value);
-	if (result < 0) {
-		dev_err(&priv->i2c->dev, "Turning RF off failed (%d)", result);
+	if (client->mode != mode_idle) {
+		schedule_work(&priv->polling_work);
+	}
+
+	return client;
+}
+
+// Remove a client from the reader, cancelling its commands.
+static void cr14_client_destroy(struct cr14_client *client)
+{
+	struct cr14_i2c_data *priv = client->priv;
+	int clients_count;
+
+	mutex_lock(&priv->command_lock);
+	client->closed = 1;
+	client->mode = mode_idle;
+	cr14_cancel_commands(priv, client);
+	list_del(&client->list);
+	clients_count = priv->clients_count - 1;
+	WRITE_ONCE(priv->clients_count, clients_count);
+	cr14_abort_session_if_unneeded(priv);
+	mutex_unlock(&priv->command_lock);
+
+	if (clients_count == 0) {
+		cancel_work_sync(&priv->polling_work);
+		stop_polling_timer(priv);
+	}
+	kref_put(&client->kref, cr14_client_release);
+}
+
+static int cr14_open(struct inode *inode, struct file *file)
+{
+	struct cr14_i2c_data *priv;
+	struct cr14_client *client;
+	priv = container_of(inode->i_cdev, struct cr14_i2c_data, cdev);
+
+	if (file->f_mode & FMODE_WRITE) {
+		client = cr14_client_create(priv, mode_idle,
+					    priority_interactive);
+	} else {
+		client = cr14_client_create(priv, mode_poll_repeat,
+					    priority_background);
+	}
+	if (!client) {
+		return -ENOMEM;
+	}
+	file->private_data = client;
+
+	return 0;
+}
+
+static int cr14_release(struct inode *inode, struct file *file)
+{
+	struct cr14_client *client = (struct cr14_client *)file->private_data;
+	cr14_client_destroy(client);
+	return 0;
+}
+
+static ssize_t cr14_read(struct file *file, char __user *buffer, size_t len,
+			 loff_t *ppos)
+{
+	struct cr14_client *client = (struct cr14_client *)file->private_data;
+	int read_count = 0;
+	mutex_lock(&client->consumer_lock);
+	if (wait_event_interruptible(client->read_wq,
+				     client->read_buffer_head !=
+					     client->read_buffer_tail)) {
+		mutex_unlock(&client->consumer_lock);
+		return -ERESTARTSYS;
+	}
+	spin_lock(&client->producer_lock);
+	cr14_histogram_add(client->priv, histogram_ring_dwell,
+			   client->oldest_unread);
+	spin_unlock(&client->producer_lock);
+	/* Read index before reading contents at that index. */
+	while (len > 0) {
+		unsigned long head =
+			smp_load_acquire(&client->read_buffer_head);
+		unsigned long tail = client->read_buffer_tail;
+		if (CIRC_CNT(head, tail, CIRCULAR_BUFFER_SIZE) >= 1) {
+			if (copy_to_user(buffer, &client->read_buffer[tail],
+					 1)) {
+				read_count = -EFAULT;
+				break;
+			}
+			buffer++;
+			read_count++;
+			len--;
+			/* Finish reading descriptor before incrementing tail. */
+			smp_store_release(&client->read_buffer_tail,
+					  (tail + 1) &
+						  (CIRCULAR_BUFFER_SIZE - 1));
+		} else {
+			// Len was exhausted, exit
+			break;
+		}
+	}
+	mutex_unlock(&client->consumer_lock);
+	if (read_count > 0) {
+		*ppos += read_count;
 	}
+	return read_count;
+}
+
+// Set the mode of a client, cancelling its commands.
+// Called with command_lock held.
+static void cr14_set_client_mode(struct cr14_client *client,
+				 enum cr14_mode mode)
+{
+	struct cr14_i2c_data *priv = client->priv;
+	cr14_cancel_commands(priv, client);
+	client->mode = mode;
+	client->poll_submitted = ktime_get();
+	if (mode != mode_idle) {
+		if (client->priority == priority_realtime) {
+			WRITE_ONCE(priv->preempt, true);
+		}
+		trigger_polling_work(priv);
+	} else {
+		cr14_abort_session_if_unneeded(priv);
+	}
+}
 
-	if (priv->mode != mode_idle) {
-		restart_polling_timer(priv);
+// Set the priority class of a client.
+// Called with command_lock held.
+static int cr14_set_client_priority(struct cr14_client *client, u8 priority)
+{
+	if (priority >= priority_classes_count) {
+		return -EINVAL;
+	}
+	client->priority = priority;
+	return 0;
+}
+
+// Expand a range command into addresses and data of a multiple blocks
+// command.
+static int cr14_parse_range_command(struct cr14_command *cmd,
+				    const u8 *packet)
+{
+	u8 *chip_uid;
+	u8 *addresses_count;
+	u8 *addr;
+	u8 *data = cmd->params.write_multiple_blocks.data;
+	u8 start = packet[9];
+	u8 count = packet[10];
+	u8 stride = packet[11] ? packet[11] : 1;
+	int ix;
+	if (count && start + ((count - 1) * stride) > 255) {
+		return -EINVAL;
+	}
+	if (packet[0] == MESSAGE_READ_RANGE_HEADER) {
+		cmd->mode = mode_read_range;
+		chip_uid = cmd->params.read_multiple_blocks.chip_uid;
+		addresses_count =
+			&cmd->params.read_multiple_blocks.addresses_count;
+		addr = cmd->params.read_multiple_blocks.addr;
+	} else {
+		chip_uid = cmd->params.write_multiple_blocks.chip_uid;
+		addresses_count =
+			&cmd->params.write_multiple_blocks.addresses_count;
+		addr = cmd->params.write_multiple_blocks.addr;
+	}
+	memcpy(chip_uid, packet + 1, 8);
+	*addresses_count = count;
+	for (ix = 0; ix < count; ix++) {
+		addr[ix] = start + (ix * stride);
+	}
+	if (packet[0] == MESSAGE_WRITE_RANGE_HEADER) {
+		cmd->mode = mode_write_range;
+		memcpy(data, packet + 12, count * 4);
+	} else if (packet[0] == MESSAGE_FILL_RANGE_HEADER) {
+		cmd->mode = mode_fill_range;
+		for (ix = 0; ix < count; ix++) {
+			memcpy(data + (ix * 4), packet + 12, 4);
+		}
 	}
+	return 0;
 }
 
-static void cr14_polling_timer_cb(struct timer_list *t)
+// Queue the command in the client write buffer.
+// Called with command_lock held.
+static int cr14_queue_command(struct cr14_client *client)
+{
+	struct cr14_command *cmd;
+	int addr_count;
+	int err;
+
+	// Do not wait for commands to be freed, as this requires command_lock.
+	cmd = mempool_alloc(client->priv->command_pool, GFP_NOWAIT);
+	if (!cmd) {
+		return -ENOMEM;
+	}
+	memset(cmd, 0, sizeof(*cmd));
+	switch (client->write_buffer[0]) {
+	case MESSAGE_READ_SINGLE_BLOCK_HEADER:
+		cmd->mode = mode_read_single_block;
+		memcpy(cmd->params.read_single_block.chip_uid,
+		       client->write_buffer + 1, 8);
+		cmd->params.read_single_block.addr = client->write_buffer[9];
+		break;
+
+	case MESSAGE_WRITE_SINGLE_BLOCK_HEADER:
+		cmd->mode = mode_write_single_block;
+		memcpy(cmd->params.write_single_block.chip_uid,
+		       client->write_buffer + 1, 8);
+		cmd->params.write_single_block.addr = client->write_buffer[9];
+		memcpy(cmd->params.write_single_block.data,
+		       client->write_buffer + 10, 4);
+		break;
+
+	case MESSAGE_READ_MULTIPLE_BLOCKS_HEADER:
+		cmd->mode = mode_read_multiple_blocks;
+		memcpy(cmd->params.read_multiple_blocks.chip_uid,
+		       client->write_buffer + 1, 8);
+		addr_count = client->write_buffer[9];
+		cmd->params.read_multiple_blocks.addresses_count = addr_count;
+		memcpy(cmd->params.read_multiple_blocks.addr,
+		       client->write_buffer + 10, addr_count);
+		break;
+
+	case MESSAGE_WRITE_MULTIPLE_BLOCKS_HEADER:
+		cmd->mode = mode_write_multiple_blocks;
+		memcpy(cmd->params.write_multiple_blocks.chip_uid,
+		       client->write_buffer + 1, 8);
+		addr_count = client->write_buffer[9];
+		cmd->params.write_multiple_blocks.addresses_count = addr_count;
+		memcpy(cmd->params.write_multiple_blocks.addr,
+		       client->write_buffer + 10, addr_count);
+		memcpy(cmd->params.write_multiple_blocks.data,
+		       client->write_buffer + 10 + addr_count, addr_count * 4);
+		break;
+
+	case MESSAGE_READ_RANGE_HEADER:
+	case MESSAGE_WRITE_RANGE_HEADER:
+	case MESSAGE_FILL_RANGE_HEADER:
+		err = cr14_parse_range_command(
+			cmd, (const u8 *)client->write_buffer);
+		if (err) {
+			mempool_free(cmd, client->priv->command_pool);
+			return err;
+		}
+		break;
+	}
+	cmd->client = client;
+	cmd->priority = client->priority;
+	cmd->submitted = ktime_get();
+	kref_get(&client->kref);
+	client->queued_commands++;
+	list_add_tail(&cmd->list, &client->commands);
+	// Sending a command cancels polling.
+	client->mode = mode_idle;
+	if (cmd->priority == priority_realtime) {
+		WRITE_ONCE(client->priv->preempt, true);
+	}
+	trigger_polling_work(client->priv);
+	return 0;
+}
+
+static ssize_t cr14_write(struct file *file, const char __user *buffer,
+			  size_t len, loff_t *ppos)
+{
+	struct cr14_client *client = (struct cr14_client *)file->private_data;
+	struct cr14_i2c_data *priv = client->priv;
+	int written_count = 0;
+	if (len == 0) {
+		return 0;
+	}
+	if (wait_event_interruptible(client->write_wq,
+				     READ_ONCE(client->queued_commands) <
+					     CLIENT_MAX_QUEUED_COMMANDS)) {
+		return -ERESTARTSYS;
+	}
+	mutex_lock(&priv->command_lock);
+	do {
+		int packet_len = 0;
+		char mode_header;
+		if (client->write_offset == 0) {
+			// Next byte is message header.
+			if (copy_from_user(client->write_buffer, buffer, 1)) {
+				written_count = -EFAULT;
+				break;
+			}
+			len--;
+			written_count++;
+			mode_header = client->write_buffer[0];
+			if (mode_header == MESSAGE_IDLE_HEADER) {
+				cr14_set_client_mode(client, mode_idle);
+				break;
+			} else if (mode_header == MESSAGE_POLL_ONCE_HEADER) {
+				cr14_set_client_mode(client, mode_poll_once);
+				break;
+			} else if (mode_header ==
+				   MESSAGE_POLL_REPEAT_MODE_HEADER) {
+				cr14_set_client_mode(client, mode_poll_repeat);
+				break;
+			}
+			client->write_offset++;
+			buffer++;
+		} else {
+			mode_header = client->write_buffer[0];
+		}
+		if (mode_header == MESSAGE_PRIORITY_CLASS_HEADER ||
+		    mode_header == MESSAGE_ROUND_SUMMARY_HEADER) {
+			packet_len = 2;
+		} else if (mode_header == MESSAGE_READ_SINGLE_BLOCK_HEADER) {
+			packet_len = 10;
+		} else if (mode_header == MESSAGE_WRITE_SINGLE_BLOCK_HEADER) {
+			packet_len = 14;
+		} else if (mode_header == MESSAGE_READ_MULTIPLE_BLOCKS_HEADER) {
+			packet_len = 10;
+		} else if (mode_header ==
+			   MESSAGE_WRITE_MULTIPLE_BLOCKS_HEADER) {
+			packet_len = 10;
+		} else if (mode_header == MESSAGE_READ_RANGE_HEADER ||
+			   mode_header == MESSAGE_WRITE_RANGE_HEADER) {
+			packet_len = 12;
+		} else if (mode_header == MESSAGE_FILL_RANGE_HEADER) {
+			packet_len = 16;
+		}
+		if (client->write_offset < packet_len) {
+			int attempt_count = packet_len - client->write_offset;
+			if (attempt_count > len) {
+				attempt_count = len;
+			}
+			if (copy_from_user(client->write_buffer +
+						   client->write_offset,
+					   buffer, attempt_count)) {
+				written_count = -EFAULT;
+				break;
+			}
+			len -= attempt_count;
+			written_count += attempt_count;
+			client->write_offset += attempt_count;
+			buffer += attempt_count;
+		}
+		// Fix packet_len with variable-size packets.
+		if (client->write_offset >= packet_len) {
+			if (mode_header ==
+			    MESSAGE_READ_MULTIPLE_BLOCKS_HEADER) {
+				packet_len = 10 + (client->write_buffer[9]);
+			} else if (mode_header ==
+				   MESSAGE_WRITE_MULTIPLE_BLOCKS_HEADER) {
+				packet_len = 10 + (client->write_buffer[9] * 5);
+			} else if (mode_header == MESSAGE_WRITE_RANGE_HEADER) {
+				packet_len = 12 + (client->write_buffer[10] * 4);
+			}
+		}
+		// Read variable-size data
+		if (client->write_offset < packet_len) {
+			int attempt_count = packet_len - client->write_offset;
+			if (attempt_count > len) {
+				attempt_count = len;
+			}
+			if (copy_from_user(client->write_buffer +
+						   client->write_offset,
+					   buffer, attempt_count)) {
+				written_count = -EFAULT;
+				break;
+			}
+			len -= attempt_count;
+			written_count += attempt_count;
+			client->write_offset += attempt_count;
+			buffer += attempt_count;
+		}
+		if (client->write_offset == packet_len) {
+			// End of packet.
+			int err;
+			if (mode_header == MESSAGE_PRIORITY_CLASS_HEADER) {
+				err = cr14_set_client_priority(
+					client, client->write_buffer[1]);
+			} else if (mode_header ==
+				   MESSAGE_ROUND_SUMMARY_HEADER) {
+				client->round_summary =
+					client->write_buffer[1] != 0;
+				err = 0;
+			} else {
+				err = cr14_queue_command(client);
+			}
+			client->write_offset = 0;
+			if (err) {
+				written_count = err;
+			}
+		}
+	} while (0);
+	mutex_unlock(&priv->command_lock);
+	if (written_count > 0) {
+		*ppos += written_count;
+	}
+	return written_count;
+}
+
+static unsigned int cr14_poll(struct file *file, poll_table *wait)
+{
+	struct cr14_client *client = (struct cr14_client *)file->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(file, &client->read_wq, wait);
+	poll_wait(file, &client->write_wq, wait);
+	if (READ_ONCE(client->read_buffer_head) !=
+	    READ_ONCE(client->read_buffer_tail)) {
+		mask |= POLLIN | POLLRDNORM;
+	}
+	if (READ_ONCE(client->queued_commands) < CLIENT_MAX_QUEUED_COMMANDS) {
+		mask |= POLLOUT | POLLWRNORM;
+	}
+
+	return mask;
+}
+
+static long cr14_ioctl_get_tags(struct cr14_i2c_data *priv,
+				struct cr14_tags __user *arg)
+{
+	struct cr14_tag *tags;
+	struct cr14_tags *result;
+	int count;
+	int ix;
+	long err = 0;
+
+	tags = kcalloc(MAX_PRESENT_TAGS, sizeof(*tags), GFP_KERNEL);
+	result = kzalloc(sizeof(*result), GFP_KERNEL);
+	if (!tags || !result) {
+		kfree(tags);
+		kfree(result);
+		return -ENOMEM;
+	}
+	count = cr14_get_tags(priv, tags);
+	result->count = count;
+	for (ix = 0; ix < count; ix++) {
+		memcpy(result->tags[ix].uid, tags[ix].uid, 8);
+		result->tags[ix].first_seen_ns = ktime_to_ns(tags[ix].first_seen);
+		result->tags[ix].last_seen_ns = ktime_to_ns(tags[ix].last_seen);
+		result->tags[ix].model = tags[ix].model;
+		result->tags[ix].link = tags[ix].link;
+	}
+	if (copy_to_user(arg, result, sizeof(*result))) {
+		err = -EFAULT;
+	}
+	kfree(tags);
+	kfree(result);
+	return err;
+}
+
+static long cr14_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct cr14_client *client = (struct cr14_client *)file->private_data;
+	switch (cmd) {
+	case CR14_IOC_GET_TAGS:
+		return cr14_ioctl_get_tags(client->priv,
+					   (struct cr14_tags __user *)arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static struct file_operations cr14_fops = {
+	.owner = THIS_MODULE,
+	.open = cr14_open,
+	.read = cr14_read,
+	.write = cr14_write,
+	.release = cr14_release,
+	.poll = cr14_poll,
+	.unlocked_ioctl = cr14_ioctl,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0)
+	.compat_ioctl = compat_ptr_ioctl,
+#endif
+};
+
+// ========================================================================== //
+// Memory attributes
+// ========================================================================== //
+
+// Consume a response written to an in-kernel client.
+static void cr14_client_consume(struct cr14_client *client, u8 *data, int len)
+{
+	int ix;
+	for (ix = 0; ix < len; ix++) {
+		unsigned long tail = client->read_buffer_tail;
+		data[ix] = client->read_buffer[tail];
+		smp_store_release(&client->read_buffer_tail,
+				  (tail + 1) & (CIRCULAR_BUFFER_SIZE - 1));
+	}
+}
+
+// Run the command in the write buffer of an in-kernel client and wait for
+// its response of len bytes.
+static int cr14_client_transfer(struct cr14_client *client, u8 *response,
+				int len)
+{
+	struct cr14_i2c_data *priv = client->priv;
+	long timeout;
+	int err;
+
+	mutex_lock(&priv->command_lock);
+	err = cr14_queue_command(client);
+	mutex_unlock(&priv->command_lock);
+	if (err) {
+		return err;
+	}
+	timeout = wait_event_interruptible_timeout(
+		client->read_wq,
+		CIRC_CNT(smp_load_acquire(&client->read_buffer_head),
+			 client->read_buffer_tail, CIRCULAR_BUFFER_SIZE) >= len,
+		msecs_to_jiffies(MEMORY_ACCESS_TIMEOUT_MS));
+	if (timeout < 0) {
+		return timeout;
+	}
+	if (timeout == 0) {
+		return -ETIMEDOUT;
+	}
+	cr14_client_consume(client, response, len);
+	return 0;
+}
+
+// Read or write blocks of a chip covering count bytes at offset off.
+// Offset and count are checked by sysfs against the size of the attribute.
+static ssize_t cr14_memory_access(struct cr14_memory_node *node, char *buf,
+				  loff_t off, size_t count, bool write)
+{
+	struct cr14_client *client;
+	u8 *response;
+	u8 *data;
+	u8 first = off / 4;
+	u8 blocks_count = ((off + count - 1) / 4) - first + 1;
+	int len = 2 + (blocks_count * 4);
+	int err = 0;
+
+	if (count == 0) {
+		return 0;
+	}
+	response = kmalloc(len, GFP_KERNEL);
+	if (!response) {
+		return -ENOMEM;
+	}
+	data = response + 2;
+	client = cr14_client_create(node->priv, mode_idle,
+				    priority_interactive);
+	if (!client) {
+		kfree(response);
+		return -ENOMEM;
+	}
+	do {
+		client->write_buffer[0] = MESSAGE_READ_RANGE_HEADER;
+		memcpy(client->write_buffer + 1, node->uid, 8);
+		client->write_buffer[9] = first;
+		client->write_buffer[10] = blocks_count;
+		client->write_buffer[11] = 1;
+		if (!write || (off % 4) || ((off + count) % 4)) {
+			err = cr14_client_transfer(client, response, len);
+			if (err) {
+				break;
+			}
+		}
+		if (!write) {
+			memcpy(buf, data + (off % 4), count);
+			break;
+		}
+		memcpy(data + (off % 4), buf, count);
+		client->write_buffer[0] = MESSAGE_WRITE_RANGE_HEADER;
+		memcpy(client->write_buffer + 12, data, blocks_count * 4);
+		err = cr14_client_transfer(client, response, 2);
+		if (err) {
+			break;
+		}
+		// Response holds the number of mismatching blocks.
+		if (response[1] != 0) {
+			err = -EIO;
+		}
+	} while (0);
+	cr14_client_destroy(client);
+	kfree(response);
+	return err ? err : count;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+#define CR14_BIN_ATTRIBUTE struct bin_attribute
+#else
+#define CR14_BIN_ATTRIBUTE const struct bin_attribute
+#endif
+
+static ssize_t cr14_memory_read(struct file *filp, struct kobject *kobj,
+				CR14_BIN_ATTRIBUTE *attr, char *buf,
+				loff_t off, size_t count)
+{
+	return cr14_memory_access(attr->private, buf, off, count, false);
+}
+
+static ssize_t cr14_memory_write(struct file *filp, struct kobject *kobj,
+				 CR14_BIN_ATTRIBUTE *attr, char *buf,
+				 loff_t off, size_t count)
+{
+	return cr14_memory_access(attr->private, buf, off, count, true);
+}
+
+static bool cr14_memory_tag_present(const u8 *uid, struct cr14_tag *tags,
+				    int count)
+{
+	int ix;
+	for (ix = 0; ix < count; ix++) {
+		if (memcmp(tags[ix].uid, uid, 8) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Create a memory attribute for a chip.
+// Called with memory_lock held.
+static void cr14_memory_add_node(struct cr14_i2c_data *priv,
+				 struct cr14_tag *tag)
+{
+	struct cr14_memory_node *node = NULL;
+	const u8 *uid = tag->uid;
+	int err;
+	int ix;
+	for (ix = 0; ix < MAX_PRESENT_TAGS; ix++) {
+		if (priv->memory_nodes[ix].used) {
+			if (memcmp(priv->memory_nodes[ix].uid, uid, 8) == 0) {
+				return;
+			}
+		} else if (node == NULL) {
+			node = &priv->memory_nodes[ix];
+		}
+	}
+	if (node == NULL) {
+		return;
+	}
+	memset(node, 0, sizeof(*node));
+	node->priv = priv;
+	memcpy(node->uid, uid, 8);
+	snprintf(node->name, sizeof(node->name),
+		 "%02x%02x%02x%02x%02x%02x%02x%02x", uid[7], uid[6], uid[5],
+		 uid[4], uid[3], uid[2], uid[1], uid[0]);
+	sysfs_bin_attr_init(&node->attr);
+	node->attr.attr.name = node->name;
+	node->attr.attr.mode = 0660;
+	node->attr.size = cr14_tag_model_blocks[tag->model] * 4;
+	node->attr.private = node;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0) && \
+	LINUX_VERSION_CODE < KERNEL_VERSION(6, 17, 0)
+	node->attr.read_new = cr14_memory_read;
+	node->attr.write_new = cr14_memory_write;
+#else
+	node->attr.read = cr14_memory_read;
+	node->attr.write = cr14_memory_write;
+#endif
+	err = sysfs_create_bin_file(priv->memory_kobj, &node->attr);
+	if (err) {
+		dev_err(&priv->i2c->dev, "Failed to create memory attribute: %d",
+			err);
+		return;
+	}
+	node->used = true;
+}
+
+// Remove memory attribute of a chip. Waits for pending accesses.
+// Called with memory_lock held.
+static void cr14_memory_remove_node(struct cr14_i2c_data *priv,
+				    struct cr14_memory_node *node)
+{
+	sysfs_remove_bin_file(priv->memory_kobj, &node->attr);
+	node->used = false;
+}
+
+// Synchronize memory attributes with present chips.
+// Runs in its own work, as removing an attribute waits for pending accesses
+// which need the polling work.
+static void cr14_sync_memory_nodes(struct work_struct *work)
+{
+	struct cr14_i2c_data *priv =
+		container_of(work, struct cr14_i2c_data, memory_work);
+	struct cr14_tag *tags = priv->memory_tags;
+	int count;
+	int ix;
+
+	mutex_lock(&priv->memory_lock);
+	count = cr14_get_tags(priv, tags);
+	if (!priv->memory_closing && priv->memory_kobj) {
+		for (ix = 0; ix < MAX_PRESENT_TAGS; ix++) {
+			struct cr14_memory_node *node = &priv->memory_nodes[ix];
+			if (node->used &&
+			    !cr14_memory_tag_present(node->uid, tags, count)) {
+				cr14_memory_remove_node(priv, node);
+			}
+		}
+		for (ix = 0; ix < count; ix++) {
+			if (cr14_tag_model_blocks[tags[ix].model]) {
+				cr14_memory_add_node(priv, &tags[ix]);
+			}
+		}
+	}
+	mutex_unlock(&priv->memory_lock);
+}
+
+// Remove every memory attribute, before the device is destroyed.
+static void cr14_memory_cleanup(struct cr14_i2c_data *priv)
+{
+	int ix;
+	mutex_lock(&priv->memory_lock);
+	priv->memory_closing = true;
+	mutex_unlock(&priv->memory_lock);
+	cancel_work_sync(&priv->memory_work);
+	if (priv->memory_kobj) {
+		for (ix = 0; ix < MAX_PRESENT_TAGS; ix++) {
+			if (priv->memory_nodes[ix].used) {
+				cr14_memory_remove_node(
+					priv, &priv->memory_nodes[ix]);
+			}
+		}
+		kobject_put(priv->memory_kobj);
+		priv->memory_kobj = NULL;
+	}
+}
+
+// ========================================================================== //
+// Sysfs attributes
+// ========================================================================== //
+
+static const char *const cr14_priority_names[priority_classes_count] = {
+	"realtime",
+	"interactive",
+	"background",
+};
+
+// Latency of commands and poll once requests, per priority class:
+// <class> <count> <average latency (usec)> <maximum latency (usec)>
+static ssize_t latency_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct cr14_i2c_data *priv = dev_get_drvdata(dev);
+	int len = 0;
+	int ix;
+	mutex_lock(&priv->command_lock);
+	for (ix = 0; ix < priority_classes_count; ix++) {
+		struct cr14_latency_stats *stats = &priv->latency[ix];
+		u64 average_ns = 0;
+		if (stats->count) {
+			average_ns = div64_u64(stats->total_ns, stats->count);
+		}
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%s %llu %llu %llu\n", cr14_priority_names[ix],
+				 (unsigned long long)stats->count,
+				 (unsigned long long)div_u64(average_ns,
+							     NSEC_PER_USEC),
+				 (unsigned long long)div_u64(stats->max_ns,
+							     NSEC_PER_USEC));
+	}
+	mutex_unlock(&priv->command_lock);
+	return len;
+}
+static DEVICE_ATTR_RO(latency);
+
+static ssize_t dedup_window_ms_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct cr14_i2c_data *priv = dev_get_drvdata(dev);
+	return scnprintf(buf, PAGE_SIZE, "%u\n",
+			 READ_ONCE(priv->dedup_window_ms));
+}
+
+static ssize_t dedup_window_ms_store(struct device *dev,
+				     struct device_attribute *attr,
+				     const char *buf, size_t count)
+{
+	struct cr14_i2c_data *priv = dev_get_drvdata(dev);
+	unsigned int value;
+	int err = kstrtouint(buf, 0, &value);
+	if (err) {
+		return err;
+	}
+	WRITE_ONCE(priv->dedup_window_ms, value);
+	return count;
+}
+static DEVICE_ATTR_RW(dedup_window_ms);
+
+static ssize_t heartbeat_ms_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct cr14_i2c_data *priv = dev_get_drvdata(dev);
+	return scnprintf(buf, PAGE_SIZE, "%u\n", READ_ONCE(priv->heartbeat_ms));
+}
+
+static ssize_t heartbeat_ms_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct cr14_i2c_data *priv = dev_get_drvdata(dev);
+	unsigned int value;
+	int err = kstrtouint(buf, 0, &value);
+	if (err) {
+		return err;
+	}
+	WRITE_ONCE(priv->heartbeat_ms, value);
+	return count;
+}
+static DEVICE_ATTR_RW(heartbeat_ms);
+
+// UIDs of chips currently present, in big endian.
+static ssize_t tags_show(struct device *dev, struct device_attribute *attr,
+			 char *buf)
+{
+	struct cr14_i2c_data *priv = dev_get_drvdata(dev);
+	struct cr14_tag *tags;
+	int count;
+	int len = 0;
+	int ix;
+
+	tags = kcalloc(MAX_PRESENT_TAGS, sizeof(*tags), GFP_KERNEL);
+	if (!tags) {
+		return -ENOMEM;
+	}
+	// Other details are available with CR14_IOC_GET_TAGS.
+	BUILD_BUG_ON(MAX_PRESENT_TAGS * 17 > PAGE_SIZE);
+	count = cr14_get_tags(priv, tags);
+	for (ix = 0; ix < count; ix++) {
+		const u8 *uid = tags[ix].uid;
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%02x%02x%02x%02x%02x%02x%02x%02x\n", uid[7],
+				 uid[6], uid[5], uid[4], uid[3], uid[2], uid[1],
+				 uid[0]);
+	}
+	kfree(tags);
+	return len;
+}
+static DEVICE_ATTR_RO(tags);
+
+static ssize_t rf_duty_cycle_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct cr14_i2c_data *priv = dev_get_drvdata(dev);
+	return scnprintf(buf, PAGE_SIZE, "%u\n",
+			 READ_ONCE(priv->rf_duty_cycle));
+}
+
+static ssize_t rf_duty_cycle_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct cr14_i2c_data *priv = dev_get_drvdata(dev);
+	unsigned int value;
+	int err = kstrtouint(buf, 0, &value);
+	if (err) {
+		return err;
+	}
+	if (value == 0 || value > 100) {
+		return -EINVAL;
+	}
+	WRITE_ONCE(priv->rf_duty_cycle, value);
+	return count;
+}
+static DEVICE_ATTR_RW(rf_duty_cycle);
+
+// RF on-time of current window:
+// <used (ms)> <budget (ms)> <window (ms)>
+static ssize_t rf_budget_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct cr14_i2c_data *priv = dev_get_drvdata(dev);
+	u64 used_ns;
+	spin_lock(&priv->budget_lock);
+	cr14_budget_roll(priv, ktime_get());
+	used_ns = priv->budget_used_ns;
+	spin_unlock(&priv->budget_lock);
+	return scnprintf(
+		buf, PAGE_SIZE, "%llu %llu %u\n",
+		(unsigned long long)div_u64(used_ns, NSEC_PER_MSEC),
+		(unsigned long long)div_u64(
+			cr14_budget_ns(READ_ONCE(priv->rf_duty_cycle),
+				       priority_interactive),
+			NSEC_PER_MSEC),
+		RF_BUDGET_WINDOW_MS);
+}
+static DEVICE_ATTR_RO(rf_budget);
+
+static struct attribute *cr14_attrs[] = {
+	&dev_attr_latency.attr,
+	&dev_attr_tags.attr,
+	&dev_attr_dedup_window_ms.attr,
+	&dev_attr_heartbeat_ms.attr,
+	&dev_attr_rf_duty_cycle.attr,
+	&dev_attr_rf_budget.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(cr14);
+
+// ========================================================================== //
+// Calibration
+// ========================================================================== //
+
+// Cost of I2C transfers, sleeps and work dispatch on the running system, to
+// tune waits for a given board. Sessions are stopped during calibration (a
+// few seconds). RF is off: frames written to measure I2C writes do not reach
+// any chip.
+
+// Lengths of parameter register (1) and frame register writes of the driver:
+// get UID, read block and write block frames.
+static const u8 cr14_calibration_write_lengths[CALIBRATION_WRITE_LENGTHS] = {
+	1, 2, 3, 7
+};
+
+// Lengths of frame register reads of the driver.
+static const u8 cr14_calibration_read_lengths[CALIBRATION_READ_LENGTHS] = {
+	1, 2, 5, 9, 19
+};
+
+struct cr14_calibration_work {
+	struct work_struct work;
+	ktime_t queued;
+	s64 latency_ns;
+	struct completion done;
+};
+
+static int cr14_calibration_compare(const void *a, const void *b)
+{
+	s64 x = *(const s64 *)a;
+	s64 y = *(const s64 *)b;
+	return x < y ? -1 : x > y;
+}
+
+// Sort samples and compute their minimum, percentiles and maximum.
+static void cr14_calibration_summarize(struct cr14_calibration_stats *stats,
+				       s64 *samples)
+{
+	sort(samples, CALIBRATION_SAMPLES, sizeof(*samples),
+	     cr14_calibration_compare, NULL);
+	stats->min_ns = samples[0];
+	stats->p50_ns = samples[DIV_ROUND_UP(CALIBRATION_SAMPLES * 50, 100) - 1];
+	stats->p99_ns = samples[DIV_ROUND_UP(CALIBRATION_SAMPLES * 99, 100) - 1];
+	stats->max_ns = samples[CALIBRATION_SAMPLES - 1];
+}
+
+// Write len bytes as the driver does: parameter register for a single byte,
+// frame register otherwise, with a frame of len - 1 bytes. RF must be off.
+static s32 cr14_calibration_i2c_write(struct cr14_i2c_data *priv, int len)
+{
+	u8 buffer[8] = { 0 };
+	if (len == 1) {
+		return i2c_smbus_write_byte_data(priv->i2c,
+						 CRX14_PARAMETER_REGISTER,
+						 CARRIER_FREQ_RF_OUT_OFF |
+							 WATCHDOG_TIMEOUT_5US);
+	}
+	buffer[0] = len - 1;
+	buffer[1] = COMMAND_GET_UID;
+	return i2c_smbus_write_i2c_block_data(
+		priv->i2c, CRX14_IO_FRAME_REGISTER, len, buffer);
+}
+
+// Measure parameter and frame register writes and frame register reads.
+// Return 0 or the first I2C error.
+static int cr14_calibrate_i2c(struct cr14_i2c_data *priv, s64 *samples)
+{
+	struct cr14_calibration *calibration = &priv->calibration;
+	u8 buffer[32];
+	ktime_t start;
+	s32 result;
+	int length;
+	int ix;
+
+	// Wait for the CR14 to be done with the last frame of the stopped
+	// session, if any.
+	result = cr14_read_frame(priv, 1, buffer);
+	if (result < 0) {
+		return result;
+	}
+	// Lengths are increasing: RF is turned off by parameter register
+	// writes before any frame is written.
+	for (length = 0; length < CALIBRATION_WRITE_LENGTHS; length++) {
+		for (ix = 0; ix < CALIBRATION_SAMPLES; ix++) {
+			start = ktime_get();
+			result = cr14_calibration_i2c_write(
+				priv, cr14_calibration_write_lengths[length]);
+			if (result < 0) {
+				return result;
+			}
+			samples[ix] =
+				ktime_to_ns(ktime_sub(ktime_get(), start));
+			if (cr14_calibration_write_lengths[length] > 1) {
+				// Wait for the CR14 to give up on the frame.
+				result = cr14_read_frame(priv, 1, buffer);
+				if (result < 0) {
+					return result;
+				}
+			}
+		}
+		cr14_calibration_summarize(&calibration->i2c_write[length],
+					   samples);
+	}
+
+	for (length = 0; length < CALIBRATION_READ_LENGTHS; length++) {
+		for (ix = 0; ix < CALIBRATION_SAMPLES; ix++) {
+			start = ktime_get();
+			result = i2c_smbus_read_i2c_block_data(
+				priv->i2c, CRX14_IO_FRAME_REGISTER,
+				cr14_calibration_read_lengths[length], buffer);
+			if (result < 0) {
+				return result;
+			}
+			samples[ix] =
+				ktime_to_ns(ktime_sub(ktime_get(), start));
+		}
+		cr14_calibration_summarize(&calibration->i2c_read[length],
+					   samples);
+	}
+	return 0;
+}
+
+// Measure how much longer than their minimum the waits of the driver last.
+static void cr14_calibrate_sleeps(struct cr14_i2c_data *priv, s64 *samples)
+{
+	ktime_t start;
+	int wait;
+	int ix;
+
+	for (wait = 0; wait < waits_count; wait++) {
+		for (ix = 0; ix < CALIBRATION_SAMPLES; ix++) {
+			start = ktime_get();
+			cr14_wait(wait);
+			samples[ix] =
+				ktime_to_ns(ktime_sub(ktime_get(), start)) -
+				cr14_waits[wait][0] * NSEC_PER_USEC;
+		}
+		cr14_calibration_summarize(
+			&priv->calibration.sleep_overshoot[wait], samples);
+	}
+}
+
+static void cr14_calibration_work_fn(struct work_struct *work)
+{
+	struct cr14_calibration_work *cw =
+		container_of(work, struct cr14_calibration_work, work);
+	cw->latency_ns = ktime_to_ns(ktime_sub(ktime_get(), cw->queued));
+	complete(&cw->done);
+}
+
+// Measure the delay between scheduling a work, as done for sessions, and its
+// execution.
+static void cr14_calibrate_workqueue(struct cr14_i2c_data *priv, s64 *samples)
+{
+	struct cr14_calibration_work cw;
+	int ix;
+
+	INIT_WORK_ONSTACK(&cw.work, cr14_calibration_work_fn);
+	init_completion(&cw.done);
+	for (ix = 0; ix < CALIBRATION_SAMPLES; ix++) {
+		reinit_completion(&cw.done);
+		cw.queued = ktime_get();
+		schedule_work(&cw.work);
+		wait_for_completion(&cw.done);
+		flush_work(&cw.work);
+		samples[ix] = cw.latency_ns;
+	}
+	destroy_work_on_stack(&cw.work);
+	cr14_calibration_summarize(&priv->calibration.workqueue_dispatch,
+				   samples);
+}
+
+// Stop sessions, as system sleep does, run every measurement and restart
+// sessions. Called with calibration_lock held.
+static int cr14_calibrate(struct cr14_i2c_data *priv)
+{
+	struct device *dev = &priv->i2c->dev;
+	bool needs_polling;
+	bool powered;
+	s64 *samples;
+	int result;
+
+	if (READ_ONCE(priv->suspended)) {
+		return -EBUSY;
+	}
+	samples = kmalloc_array(CALIBRATION_SAMPLES, sizeof(*samples),
+				GFP_KERNEL);
+	if (!samples) {
+		return -ENOMEM;
+	}
+
+	mutex_lock(&priv->command_lock);
+	WRITE_ONCE(priv->calibrating, true);
+	WRITE_ONCE(priv->abort, true);
+	mutex_unlock(&priv->command_lock);
+	cancel_work_sync(&priv->polling_work);
+
+	powered = pm_runtime_get_sync(dev) >= 0;
+	do {
+		if (!powered) {
+			result = -EIO;
+			break;
+		}
+		result = cr14_calibrate_i2c(priv, samples);
+		if (result < 0) {
+			break;
+		}
+		cr14_calibrate_sleeps(priv, samples);
+		cr14_calibrate_workqueue(priv, samples);
+	} while (0);
+	pm_runtime_mark_last_busy(dev);
+	pm_runtime_put_autosuspend(dev);
+
+	WRITE_ONCE(priv->calibrating, false);
+	mutex_lock(&priv->command_lock);
+	needs_polling = cr14_needs_polling(priv);
+	mutex_unlock(&priv->command_lock);
+	if (needs_polling) {
+		trigger_polling_work(priv);
+	}
+
+	kfree(samples);
+	priv->calibration.result = result;
+	return result;
+}
+
+// Smallest minimum of a wait that still covers the time the CR14 needs, given
+// the measured overshoot, in usec.
+static unsigned long cr14_calibration_recommended_us(struct cr14_i2c_data *priv,
+						     int wait)
+{
+	s64 overshoot_us = div_s64(
+		priv->calibration.sleep_overshoot[wait].min_ns, NSEC_PER_USEC);
+	if (overshoot_us >= cr14_waits[wait][0]) {
+		return 0;
+	}
+	return cr14_waits[wait][0] - overshoot_us;
+}
+
+// ========================================================================== //
+// Debugfs
+// ========================================================================== //
+
+static struct dentry *cr14_debugfs_root;
+
+static int cr14_stats_show(struct seq_file *s, void *data)
+{
+	struct cr14_i2c_data *priv = s->private;
+	struct cr14_stats *stats = &priv->stats;
+	seq_printf(s, "rounds %lld\n", atomic64_read(&stats->rounds));
+	seq_printf(s, "uids %lld\n", atomic64_read(&stats->uids));
+	seq_printf(s, "collisions %lld\n", atomic64_read(&stats->collisions));
+	seq_printf(s, "crc_errors %lld\n", atomic64_read(&stats->crc_errors));
+	seq_printf(s, "no_response %lld\n",
+		   atomic64_read(&stats->no_response));
+	seq_printf(s, "i2c_errors %lld\n", atomic64_read(&stats->i2c_errors));
+	seq_printf(s, "frame_retries %lld\n",
+		   atomic64_read(&stats->frame_retries));
+	seq_printf(s, "ring_drops %lld\n", atomic64_read(&stats->ring_drops));
+	seq_printf(s, "genl_drops %lld\n", atomic64_read(&stats->genl_drops));
+	seq_printf(s, "commands_completed %lld\n",
+		   atomic64_read(&stats->commands_completed));
+	seq_printf(s, "commands_cancelled %lld\n",
+		   atomic64_read(&stats->commands_cancelled));
+	seq_printf(s, "commands_retried %lld\n",
+		   atomic64_read(&stats->commands_retried));
+	seq_printf(s, "rf_on_ms %lld\n",
+		   div_s64(atomic64_read(&stats->rf_on_ns), NSEC_PER_MSEC));
+	seq_printf(s, "budget_deferrals %lld\n",
+		   atomic64_read(&stats->budget_deferrals));
+	seq_printf(s, "recoveries %lld\n", atomic64_read(&stats->recoveries));
+	seq_printf(s, "recovery_failures %lld\n",
+		   atomic64_read(&stats->recovery_failures));
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cr14_stats);
+
+static const char *const cr14_histogram_names[histograms_count] = {
+	"time_to_uid",
+	"select_to_uid",
+	"read_block",
+	"write_block",
+	"command_read_single_block",
+	"command_write_single_block",
+	"command_read_multiple_blocks",
+	"command_write_multiple_blocks",
+	"command_read_range",
+	"command_write_range",
+	"command_fill_range",
+	"ring_dwell",
+};
+
+// Upper bound of the bucket holding given percentile, in usec.
+static u64 cr14_histogram_percentile(const s64 *buckets, s64 count,
+				     int percentile)
 {
-	struct cr14_i2c_data *priv = from_timer(priv, t, polling_timer);
-	if (priv->opened) {
-		schedule_work(&priv->polling_work);
+	s64 rank = div_s64(count * percentile + 99, 100);
+	s64 cumulated = 0;
+	int ix;
+	for (ix = 0; ix < HISTOGRAM_BUCKETS - 1; ix++) {
+		cumulated += buckets[ix];
+		if (cumulated >= rank) {
+			break;
+		}
 	}
+	return 1ULL << ix;
 }
 
-static void restart_polling_timer(struct cr14_i2c_data *priv)
+static int cr14_histograms_show(struct seq_file *s, void *data)
 {
-	del_timer_sync(&priv->polling_timer);
-	mod_timer(&priv->polling_timer,
-		  jiffies + HZ / POLLING_TIMEOUT_SECS_DIV);
+	struct cr14_i2c_data *priv = s->private;
+	s64 buckets[HISTOGRAM_BUCKETS];
+	int histogram;
+	int ix;
+	for (histogram = 0; histogram < histograms_count; histogram++) {
+		s64 count = 0;
+		for (ix = 0; ix < HISTOGRAM_BUCKETS; ix++) {
+			buckets[ix] = atomic64_read(
+				&priv->histograms[histogram].buckets[ix]);
+			count += buckets[ix];
+		}
+		seq_printf(s, "%s %lld", cr14_histogram_names[histogram],
+			   count);
+		if (count) {
+			seq_printf(s, " %llu %llu",
+				   cr14_histogram_percentile(buckets, count, 50),
+				   cr14_histogram_percentile(buckets, count,
+							     99));
+		} else {
+			seq_puts(s, " 0 0");
+		}
+		for (ix = 0; ix < HISTOGRAM_BUCKETS; ix++) {
+			seq_printf(s, " %lld", buckets[ix]);
+		}
+		seq_putc(s, '\n');
+	}
+	return 0;
 }
 
-static void stop_polling_timer(struct cr14_i2c_data *priv)
+static int cr14_histograms_open(struct inode *inode, struct file *file)
 {
-	del_timer_sync(&priv->polling_timer);
+	return single_open(file, cr14_histograms_show, inode->i_private);
 }
 
-static void trigger_polling_work(struct cr14_i2c_data *priv)
+// Reset every histogram.
+static ssize_t cr14_histograms_write(struct file *file,
+				     const char __user *buffer, size_t len,
+				     loff_t *ppos)
 {
-	del_timer_sync(&priv->polling_timer);
-	if (priv->opened) {
-		schedule_work(&priv->polling_work);
+	struct seq_file *s = file->private_data;
+	struct cr14_i2c_data *priv = s->private;
+	int histogram;
+	int ix;
+	for (histogram = 0; histogram < histograms_count; histogram++) {
+		for (ix = 0; ix < HISTOGRAM_BUCKETS; ix++) {
+			atomic64_set(&priv->histograms[histogram].buckets[ix],
+				     0);
+		}
 	}
+	return len;
 }
 
-// ========================================================================== //
-// File operations & commands
-// ========================================================================== //
+static const struct file_operations cr14_histograms_fops = {
+	.owner = THIS_MODULE,
+	.open = cr14_histograms_open,
+	.read = seq_read,
+	.write = cr14_histograms_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
 
-static int cr14_open(struct inode *inode, struct file *file)
+static void cr14_calibration_print(struct seq_file *s, const char *name,
+				   const struct cr14_calibration_stats *stats)
 {
-	struct cr14_i2c_data *priv;
-	priv = container_of(inode->i_cdev, struct cr14_i2c_data, cdev);
-	file->private_data = priv;
+	seq_printf(s, "%s %lld %lld %lld %lld", name,
+		   div_s64(stats->min_ns, NSEC_PER_USEC),
+		   div_s64(stats->p50_ns, NSEC_PER_USEC),
+		   div_s64(stats->p99_ns, NSEC_PER_USEC),
+		   div_s64(stats->max_ns, NSEC_PER_USEC));
+}
 
-	if (priv->opened) {
-		return -EBUSY;
-	}
-	priv->opened = 1;
-	priv->running_command = 0;
-	priv->write_offset = 0;
-	priv->read_buffer_head = 0;
-	priv->read_buffer_tail = 0;
-	if (file->f_mode & FMODE_WRITE) {
-		priv->mode = mode_idle;
-	} else {
-		priv->mode = mode_poll_repeat;
+static int cr14_calibration_show(struct seq_file *s, void *data)
+{
+	struct cr14_i2c_data *priv = s->private;
+	struct cr14_calibration *calibration = &priv->calibration;
+	char name[24];
+	int ix;
+	mutex_lock(&priv->calibration_lock);
+	if (calibration->result < 0) {
+		seq_printf(s, "error %d\n", calibration->result);
+	} else if (calibration->result == 0) {
+		for (ix = 0; ix < CALIBRATION_WRITE_LENGTHS; ix++) {
+			snprintf(name, sizeof(name), "i2c_write_%u",
+				 cr14_calibration_write_lengths[ix]);
+			cr14_calibration_print(s, name,
+					       &calibration->i2c_write[ix]);
+			seq_putc(s, '\n');
+		}
+		for (ix = 0; ix < CALIBRATION_READ_LENGTHS; ix++) {
+			snprintf(name, sizeof(name), "i2c_read_%u",
+				 cr14_calibration_read_lengths[ix]);
+			cr14_calibration_print(s, name,
+					       &calibration->i2c_read[ix]);
+			seq_putc(s, '\n');
+		}
+		cr14_calibration_print(s, "workqueue_dispatch",
+				       &calibration->workqueue_dispatch);
+		seq_putc(s, '\n');
+		for (ix = 0; ix < waits_count; ix++) {
+			snprintf(name, sizeof(name), "sleep_%lu_%lu",
+				 cr14_waits[ix][0], cr14_waits[ix][1]);
+			cr14_calibration_print(
+				s, name, &calibration->sleep_overshoot[ix]);
+			seq_printf(s, " %lu\n",
+				   cr14_calibration_recommended_us(priv, ix));
+		}
 	}
-	schedule_work(&priv->polling_work);
-
+	mutex_unlock(&priv->calibration_lock);
 	return 0;
 }
 
-static int cr14_release(struct inode *inode, struct file *file)
+static int cr14_calibration_open(struct inode *inode, struct file *file)
 {
-	struct cr14_i2c_data *priv;
-	priv = container_of(inode->i_cdev, struct cr14_i2c_data, cdev);
-	priv->opened = 0;
-
-	cancel_work_sync(&priv->polling_work);
-	stop_polling_timer(priv);
-
-	return 0;
+	return single_open(file, cr14_calibration_show, inode->i_private);
 }
 
-static ssize_t cr14_read(struct file *file, char __user *buffer, size_t len,
-			 loff_t *ppos)
+// Run calibration.
+static ssize_t cr14_calibration_write(struct file *file,
+				      const char __user *buffer, size_t len,
+				      loff_t *ppos)
 {
-	struct cr14_i2c_data *priv = (struct cr14_i2c_data *)file->private_data;
-	int read_count = 0;
-	spin_lock(&priv->consumer_lock);
-	if (wait_event_interruptible(priv->read_wq,
-				     priv->read_buffer_head !=
-					     priv->read_buffer_tail)) {
-		spin_unlock(&priv->consumer_lock);
+	struct seq_file *s = file->private_data;
+	struct cr14_i2c_data *priv = s->private;
+	int result;
+	if (mutex_lock_interruptible(&priv->calibration_lock)) {
 		return -ERESTARTSYS;
 	}
-	/* Read index before reading contents at that index. */
-	while (len > 0) {
-		unsigned long head = smp_load_acquire(&priv->read_buffer_head);
-		unsigned long tail = priv->read_buffer_tail;
-		if (CIRC_CNT(head, tail, CIRCULAR_BUFFER_SIZE) >= 1) {
-			if (copy_to_user(buffer, &priv->read_buffer[tail], 1)) {
-				read_count = -EFAULT;
-				break;
-			}
-			buffer++;
-			read_count++;
-			len--;
-			/* Finish reading descriptor before incrementing tail. */
-			smp_store_release(&priv->read_buffer_tail,
-					  (tail + 1) &
-						  (CIRCULAR_BUFFER_SIZE - 1));
-		} else {
-			// Len was exhausted, exit
-			break;
-		}
-	}
-	spin_unlock(&priv->consumer_lock);
-	if (read_count > 0) {
-		*ppos += read_count;
-	}
-	return read_count;
+	result = cr14_calibrate(priv);
+	mutex_unlock(&priv->calibration_lock);
+	return result < 0 ? result : len;
 }
 
-static ssize_t cr14_write(struct file *file, const char __user *buffer,
-			  size_t len, loff_t *ppos)
+static const struct file_operations cr14_calibration_fops = {
+	.owner = THIS_MODULE,
+	.open = cr14_calibration_open,
+	.read = seq_read,
+	.write = cr14_calibration_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void cr14_debugfs_init(struct cr14_i2c_data *priv)
 {
-	struct cr14_i2c_data *priv = (struct cr14_i2c_data *)file->private_data;
-	int written_count = 0;
-	if (len == 0) {
-		return 0;
-	}
-	mutex_lock(&priv->command_lock);
-	if (wait_event_interruptible(priv->write_wq,
-				     priv->running_command == 0)) {
-		mutex_unlock(&priv->command_lock);
-		return -ERESTARTSYS;
-	}
-	do {
-		int packet_len = 0;
-		char mode_header;
-		if (priv->write_offset == 0) {
-			// Next byte is message header.
-			if (copy_from_user(priv->write_buffer, buffer, 1)) {
-				written_count = -EFAULT;
-				break;
-			}
-			len--;
-			written_count++;
-			mode_header = priv->write_buffer[0];
-			if (mode_header == MESSAGE_IDLE_HEADER) {
-				priv->mode = mode_idle;
-				break;
-			} else if (mode_header == MESSAGE_POLL_ONCE_HEADER) {
-				priv->mode = mode_poll_once;
-				trigger_polling_work(priv);
-				break;
-			} else if (mode_header ==
-				   MESSAGE_POLL_REPEAT_MODE_HEADER) {
-				priv->mode = mode_poll_repeat;
-				trigger_polling_work(priv);
-				break;
-			}
-			priv->write_offset++;
-			buffer++;
-		} else {
-			mode_header = priv->write_buffer[0];
-		}
-		if (mode_header == MESSAGE_READ_SINGLE_BLOCK_HEADER) {
-			packet_len = 10;
-		} else if (mode_header == MESSAGE_WRITE_SINGLE_BLOCK_HEADER) {
-			packet_len = 14;
-		} else if (mode_header == MESSAGE_READ_MULTIPLE_BLOCKS_HEADER) {
-			packet_len = 10;
-		} else if (mode_header ==
-			   MESSAGE_WRITE_MULTIPLE_BLOCKS_HEADER) {
-			packet_len = 10;
-		}
-		if (priv->write_offset < packet_len) {
-			int attempt_count = packet_len - priv->write_offset;
-			if (attempt_count > len) {
-				attempt_count = len;
-			}
-			if (copy_from_user(priv->write_buffer +
-						   priv->write_offset,
-					   buffer, attempt_count)) {
-				written_count = -EFAULT;
-				break;
-			}
-			len -= attempt_count;
-			written_count += attempt_count;
-			priv->write_offset += attempt_count;
-			buffer += attempt_count;
-		}
-		// Fix packet_len with variable-size packets.
-		if (priv->write_offset >= packet_len) {
-			if (mode_header ==
-			    MESSAGE_READ_MULTIPLE_BLOCKS_HEADER) {
-				packet_len = 10 + (priv->write_buffer[9]);
-			} else if (mode_header ==
-				   MESSAGE_WRITE_MULTIPLE_BLOCKS_HEADER) {
-				packet_len = 10 + (priv->write_buffer[9] * 5);
-			}
-		}
-		// Read variable-size data
-		if (priv->write_offset < packet_len) {
-			int attempt_count = packet_len - priv->write_offset;
-			if (attempt_count > len) {
-				attempt_count = len;
-			}
-			if (copy_from_user(priv->write_buffer +
-						   priv->write_offset,
-					   buffer, attempt_count)) {
-				written_count = -EFAULT;
-				break;
-			}
-			len -= attempt_count;
-			written_count += attempt_count;
-			priv->write_offset += attempt_count;
-			buffer += attempt_count;
-		}
-		if (priv->write_offset == packet_len) {
-			// End of packet.
-			int addr_count;
-			switch (priv->write_buffer[0]) {
-			case MESSAGE_READ_SINGLE_BLOCK_HEADER:
-				priv->mode = mode_read_single_block;
-				memcpy(priv->command_params.read_single_block
-					       .chip_uid,
-				       priv->write_buffer + 1, 8);
-				priv->command_params.read_single_block.addr =
-					priv->write_buffer[9];
-				break;
+	priv->debugfs =
+		debugfs_create_dir(dev_name(&priv->i2c->dev), cr14_debugfs_root);
+	debugfs_create_file("stats", 0444, priv->debugfs, priv,
+			    &cr14_stats_fops);
+	debugfs_create_file("histograms", 0644, priv->debugfs, priv,
+			    &cr14_histograms_fops);
+	debugfs_create_file("calibration", 0644, priv->debugfs, priv,
+			    &cr14_calibration_fops);
+}
 
-			case MESSAGE_WRITE_SINGLE_BLOCK_HEADER:
-				priv->mode = mode_write_single_block;
-				memcpy(priv->command_params.write_single_block
-					       .chip_uid,
-				       priv->write_buffer + 1, 8);
-				priv->command_params.write_single_block.addr =
-					priv->write_buffer[9];
-				memcpy(priv->command_params.write_single_block
-					       .data,
-				       priv->write_buffer + 10, 4);
-				break;
+// ========================================================================== //
+// Power management
+// ========================================================================== //
 
-			case MESSAGE_READ_MULTIPLE_BLOCKS_HEADER:
-				priv->mode = mode_read_multiple_blocks;
-				memcpy(priv->command_params.read_multiple_blocks
-					       .chip_uid,
-				       priv->write_buffer + 1, 8);
-				addr_count = priv->write_buffer[9];
-				priv->command_params.read_multiple_blocks
-					.addresses_count = addr_count;
-				memcpy(priv->command_params.read_multiple_blocks
-					       .addr,
-				       priv->write_buffer + 10, addr_count);
-				break;
+// The CR14 has no low power mode besides RF off. Runtime suspend lets the I2C
+// adapter suspend when no session runs for AUTOSUSPEND_DELAY_MS.
 
-			case MESSAGE_WRITE_MULTIPLE_BLOCKS_HEADER:
-				priv->mode = mode_write_multiple_blocks;
-				memcpy(priv->command_params
-					       .write_multiple_blocks.chip_uid,
-				       priv->write_buffer + 1, 8);
-				addr_count = priv->write_buffer[9];
-				priv->command_params.write_multiple_blocks
-					.addresses_count = addr_count;
-				memcpy(priv->command_params
-					       .write_multiple_blocks.addr,
-				       priv->write_buffer + 10, addr_count);
-				memcpy(priv->command_params
-					       .write_multiple_blocks.data,
-				       priv->write_buffer + 10 + addr_count,
-				       addr_count * 4);
-				break;
-			}
-			priv->write_offset = 0;
-			trigger_polling_work(priv);
-		}
-	} while (0);
-	mutex_unlock(&priv->command_lock);
-	if (written_count > 0) {
-		*ppos += written_count;
-	}
-	return written_count;
+static int __maybe_unused cr14_runtime_suspend(struct device *dev)
+{
+	struct i2c_client *i2c = to_i2c_client(dev);
+	s32 result;
+	result = i2c_smbus_write_byte_data(i2c, CRX14_PARAMETER_REGISTER,
+					   CARRIER_FREQ_RF_OUT_OFF |
+						   WATCHDOG_TIMEOUT_5US);
+	return result < 0 ? result : 0;
 }
 
-static unsigned int cr14_poll(struct file *file, poll_table *wait)
+static int __maybe_unused cr14_runtime_resume(struct device *dev)
 {
-	struct cr14_i2c_data *priv = (struct cr14_i2c_data *)file->private_data;
-	unsigned int mask = 0;
+	struct i2c_client *i2c = to_i2c_client(dev);
+	s32 result;
+	// Make sure the CR14 answers. Failure is transient (-EAGAIN) so that
+	// runtime PM does not keep the error and fail every later resume: the
+	// session fails and fault recovery retries.
+	result = i2c_smbus_read_byte_data(i2c, CRX14_PARAMETER_REGISTER);
+	return result < 0 ? -EAGAIN : 0;
+}
 
-	poll_wait(file, &priv->read_wq, wait);
-	poll_wait(file, &priv->write_wq, wait);
-	spin_lock(&priv->consumer_lock);
-	if (priv->read_buffer_head != priv->read_buffer_tail) {
-		mask |= POLLIN | POLLRDNORM;
+// Stop sessions. Running session is aborted at next frame and its commands
+// are put back in their queues.
+static int __maybe_unused cr14_suspend(struct device *dev)
+{
+	struct cr14_i2c_data *priv = dev_get_drvdata(dev);
+	mutex_lock(&priv->command_lock);
+	WRITE_ONCE(priv->suspended, true);
+	WRITE_ONCE(priv->abort, true);
+	mutex_unlock(&priv->command_lock);
+	cancel_work_sync(&priv->polling_work);
+	del_timer_sync(&priv->polling_timer);
+	return pm_runtime_force_suspend(dev);
+}
+
+// Restart polling and queued commands.
+static int __maybe_unused cr14_resume(struct device *dev)
+{
+	struct cr14_i2c_data *priv = dev_get_drvdata(dev);
+	bool needs_polling;
+	int err;
+	err = pm_runtime_force_resume(dev);
+	if (err) {
+		return err;
 	}
-	spin_unlock(&priv->consumer_lock);
-	if (priv->running_command == 0) {
-		mask |= POLLOUT | POLLWRNORM;
+	WRITE_ONCE(priv->suspended, false);
+	mutex_lock(&priv->command_lock);
+	needs_polling = cr14_needs_polling(priv);
+	mutex_unlock(&priv->command_lock);
+	if (needs_polling) {
+		schedule_work(&priv->polling_work);
 	}
-
-	return mask;
+	return 0;
 }
 
-static struct file_operations cr14_fops = {
-	.owner = THIS_MODULE,
-	.open = cr14_open,
-	.read = cr14_read,
-	.write = cr14_write,
-	.release = cr14_release,
-	.poll = cr14_poll,
+static const struct dev_pm_ops cr14_pm_ops = {
+	SET_SYSTEM_SLEEP_PM_OPS(cr14_suspend, cr14_resume)
+	SET_RUNTIME_PM_OPS(cr14_runtime_suspend, cr14_runtime_resume, NULL)
 };
 
 // ========================================================================== //
 // Probing, initialization and cleanup
 // ========================================================================== //
 
+// Indexes of readers, to name /dev/rfidN.
+static DEFINE_IDA(cr14_ida);
+static struct class *cr14_class;
+
+static void cr14_destroy_command_pool(void *pool)
+{
+	mempool_destroy(pool);
+}
+
+static void cr14_free_index(void *data)
+{
+	struct cr14_i2c_data *priv = data;
+	ida_free(&cr14_ida, priv->index);
+}
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
 static int cr14_i2c_probe(struct i2c_client *i2c,
 			  const struct i2c_device_id *id)
@@ -1166,24 +3906,69 @@ static int cr14_i2c_probe(struct i2c_client *i2c)
 	priv->i2c = i2c;
 
 	timer_setup(&priv->polling_timer, cr14_polling_timer_cb, 0);
+	mutex_init(&priv->command_lock);
+	INIT_LIST_HEAD(&priv->clients);
+	INIT_LIST_HEAD(&priv->batch);
+	seqlock_init(&priv->tags_lock);
+	spin_lock_init(&priv->budget_lock);
+	priv->budget_window_start = ktime_get();
+	priv->rf_duty_cycle = 100;
+	INIT_WORK(&priv->polling_work, cr14_do_poll);
+	mutex_init(&priv->memory_lock);
+	INIT_WORK(&priv->memory_work, cr14_sync_memory_nodes);
+	spin_lock_init(&priv->genl_lock);
+	INIT_WORK(&priv->genl_work, cr14_genl_work_fn);
+	mutex_init(&priv->calibration_lock);
+	priv->calibration.result = 1;
+
+	priv->command_pool = mempool_create_kmalloc_pool(
+		COMMAND_POOL_RESERVE, sizeof(struct cr14_command));
+	if (!priv->command_pool) {
+		return -ENOMEM;
+	}
+	err = devm_add_action_or_reset(dev, cr14_destroy_command_pool,
+				       priv->command_pool);
+	if (err) {
+		return err;
+	}
+
+	if (input_events) {
+		err = cr14_input_init(priv);
+		if (err) {
+			dev_err(dev, "Failed to register input device: %d", err);
+			return err;
+		}
+	}
+
+	err = cr14_trigger_init(priv);
+	if (err) {
+		if (err != -EPROBE_DEFER) {
+			dev_err(dev, "Failed to set up trigger input: %d", err);
+		}
+		return err;
+	}
+
+	pm_runtime_set_active(dev);
+	pm_runtime_set_autosuspend_delay(dev, AUTOSUSPEND_DELAY_MS);
+	pm_runtime_use_autosuspend(dev);
+	pm_runtime_enable(dev);
 
 	// Register device.
-	err = alloc_chrdev_region(&priv->chrdev, 0, 2, DEVICE_NAME);
+	err = ida_alloc(&cr14_ida, GFP_KERNEL);
 	if (err < 0) {
-		dev_err(dev, "Failed to registering character device: %d", err);
+		cr14_i2c_remove(i2c);
+		return err;
+	}
+	priv->index = err;
+	err = devm_add_action_or_reset(dev, cr14_free_index, priv);
+	if (err) {
 		cr14_i2c_remove(i2c);
 		return err;
 	}
 
-	// Create device class
-#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 4, 0)
-	priv->cr14_class = class_create(THIS_MODULE, DEVICE_NAME);
-#else
-	priv->cr14_class = class_create(DEVICE_NAME);
-#endif
-	if (IS_ERR(priv->cr14_class)) {
-		err = PTR_ERR(priv->cr14_class);
-		dev_err(dev, "class_create failed: %d", err);
+	err = alloc_chrdev_region(&priv->chrdev, 0, 2, DEVICE_NAME);
+	if (err < 0) {
+		dev_err(dev, "Failed to registering character device: %d", err);
 		cr14_i2c_remove(i2c);
 		return err;
 	}
@@ -1197,9 +3982,9 @@ static int cr14_i2c_probe(struct i2c_client *i2c)
 		return err;
 	}
 
-	priv->device = device_create(priv->cr14_class, dev, priv->chrdev, NULL,
-				     /* no additional data */ DEVICE_NAME "%d",
-				     MINOR(priv->chrdev));
+	priv->device = device_create_with_groups(cr14_class, dev, priv->chrdev,
+						 priv, cr14_groups,
+						 DEVICE_NAME "%d", priv->index);
 	if (IS_ERR(priv->device)) {
 		err = PTR_ERR(priv->device);
 		dev_err(dev, "Failed to create device: %d", err);
@@ -1207,12 +3992,18 @@ static int cr14_i2c_probe(struct i2c_client *i2c)
 		return err;
 	}
 
-	spin_lock_init(&priv->producer_lock);
-	spin_lock_init(&priv->consumer_lock);
-	mutex_init(&priv->command_lock);
-	init_waitqueue_head(&priv->read_wq);
-	init_waitqueue_head(&priv->write_wq);
-	INIT_WORK(&priv->polling_work, cr14_do_poll);
+	mutex_lock(&priv->memory_lock);
+	priv->memory_kobj =
+		kobject_create_and_add("memory", &priv->device->kobj);
+	mutex_unlock(&priv->memory_lock);
+	if (!priv->memory_kobj) {
+		dev_err(dev, "Failed to create memory directory");
+		cr14_i2c_remove(i2c);
+		return -ENOMEM;
+	}
+	schedule_work(&priv->memory_work);
+
+	cr14_debugfs_init(priv);
 
 	return 0;
 }
@@ -1226,27 +4017,35 @@ static void cr14_i2c_remove(struct i2c_client *client)
 	struct cr14_i2c_data *priv;
 	priv = i2c_get_clientdata(client);
 
+	debugfs_remove_recursive(priv->debugfs);
+	cr14_memory_cleanup(priv);
+
 	if (priv->chrdev) {
-		if (priv->cr14_class) {
-			if (priv->cdev.ops) {
-				device_destroy(priv->cr14_class,
-					       MKDEV(MAJOR(priv->chrdev),
-						     MINOR(priv->chrdev)));
-				cdev_del(&priv->cdev);
-			}
-			class_destroy(priv->cr14_class);
+		if (priv->cdev.ops) {
+			device_destroy(cr14_class, priv->chrdev);
+			cdev_del(&priv->cdev);
 		}
 		unregister_chrdev_region(priv->chrdev, 2);
 	}
 
+	WRITE_ONCE(priv->abort, true);
 	del_timer_sync(&priv->polling_timer);
 	cancel_work_sync(&priv->polling_work);
+	cancel_work_sync(&priv->genl_work);
+
+	pm_runtime_disable(&client->dev);
+	pm_runtime_dont_use_autosuspend(&client->dev);
+	pm_runtime_set_suspended(&client->dev);
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 0, 0)
 	return 0;
 #endif
 }
 
+// Also allows instantiation from userspace or by cr14_sim.
+static const struct i2c_device_id cr14_i2c_id[] = { { DRV_NAME, 0 }, {} };
+MODULE_DEVICE_TABLE(i2c, cr14_i2c_id);
+
 #ifdef CONFIG_OF
 static const struct of_device_id cr14_i2c_ids[] = { {
 							    .compatible =
@@ -1260,12 +4059,53 @@ static struct i2c_driver cr14_i2c_driver = {
     .driver = {
         .name = DRV_NAME,
         .of_match_table = of_match_ptr(cr14_i2c_ids),
+        .pm = &cr14_pm_ops,
     },
     .probe              = cr14_i2c_probe,
+    .id_table           = cr14_i2c_id,
     .remove             = cr14_i2c_remove,
 };
 
-module_i2c_driver(cr14_i2c_driver);
+static int __init cr14_init(void)
+{
+	int err;
+	// Class is shared by readers.
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 4, 0)
+	cr14_class = class_create(THIS_MODULE, DEVICE_NAME);
+#else
+	cr14_class = class_create(DEVICE_NAME);
+#endif
+	if (IS_ERR(cr14_class)) {
+		return PTR_ERR(cr14_class);
+	}
+	err = genl_register_family(&cr14_genl_family);
+	if (err) {
+		class_destroy(cr14_class);
+		return err;
+	}
+	cr14_debugfs_root = debugfs_create_dir(DRV_NAME, NULL);
+	err = i2c_add_driver(&cr14_i2c_driver);
+	if (err) {
+		debugfs_remove_recursive(cr14_debugfs_root);
+		genl_unregister_family(&cr14_genl_family);
+		class_destroy(cr14_class);
+	}
+	return err;
+}
+module_init(cr14_init);
+
+static void __exit cr14_exit(void)
+{
+	i2c_del_driver(&cr14_i2c_driver);
+	debugfs_remove_recursive(cr14_debugfs_root);
+	genl_unregister_family(&cr14_genl_family);
+	class_destroy(cr14_class);
+}
+module_exit(cr14_exit);
+
+#ifdef CR14_KUNIT_TEST
+#include "cr14_kunit.c"
+#endif
 
 MODULE_DESCRIPTION("STMicroelectronics CR14 Driver");
 MODULE_AUTHOR("Paul Guyot <pguyot@kallisys.net>");
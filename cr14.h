@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: GPL-2.0-only WITH Linux-syscall-note */
+/*
+ * CR14 RFID Reader Driver - userspace interface
+ *
+ * Copyright (c) 2020 Paul Guyot <pguyot@kallisys.net>
+ */
+
+#ifndef _CR14_H
+#define _CR14_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// Byte protocol of /dev/rfid0 is described in cr14.c.
+
+// Commands a client can queue. Writes block while the queue is full.
+#define CR14_MAX_QUEUED_COMMANDS 16
+
+// ========================================================================== //
+// Chip models
+// ========================================================================== //
+
+enum cr14_tag_model {
+	CR14_MODEL_UNKNOWN = 0,
+	CR14_MODEL_SRIX4K,
+	CR14_MODEL_SRI512,
+	CR14_MODEL_SRT512,
+	CR14_MODEL_SRI4K,
+	CR14_MODEL_SRI2K,
+	CR14_MODEL_ST25TB512_AC,
+	CR14_MODEL_ST25TB04K,
+	CR14_MODEL_ST25TB512_AT,
+	CR14_MODEL_ST25TB02K,
+};
+
+// ========================================================================== //
+// ioctls
+// ========================================================================== //
+
+#define CR14_MAX_TAGS 64
+
+// Link quality of a chip since it arrived. Frames are counted while the chip
+// is selected, i.e. once its UID is known.
+struct cr14_tag_link {
+	__u32 frames; // successful block reads and writes
+	__u32 crc_errors; // CRC errors (or collisions) in replies
+	__u32 no_response; // chip did not reply
+	__u32 collisions; // UID found with slot markers, after a collision
+	__u32 retries; // command attempts that failed, to be retried
+	__u32 reserved;
+};
+
+// Chip currently present on the reader.
+// Times are CLOCK_MONOTONIC, in nanoseconds.
+struct cr14_tag_info {
+	__u8 uid[8]; // little endian (LSB first)
+	__u64 first_seen_ns;
+	__u64 last_seen_ns;
+	__u32 model; // enum cr14_tag_model
+	__u32 reserved;
+	struct cr14_tag_link link;
+};
+
+struct cr14_tags {
+	__u32 count; // number of present chips
+	__u32 reserved;
+	struct cr14_tag_info tags[CR14_MAX_TAGS];
+};
+
+#define CR14_IOC_MAGIC 0xC1
+
+// Get the chips currently present on the reader, as found by polling.
+// Does not disturb polling or commands of other clients. The device can be
+// opened read-write (idle mode) to only use this ioctl.
+#define CR14_IOC_GET_TAGS _IOR(CR14_IOC_MAGIC, 0x01, struct cr14_tags)
+
+// ========================================================================== //
+// Generic netlink events
+// ========================================================================== //
+
+// Family CR14_GENL_NAME has a multicast group per event type. Listeners
+// subscribe to the groups of the events they need and can filter messages by
+// reader with attribute CR14_ATTR_READER, the index N of its device
+// /dev/rfidN. Indexes are allocated in probe order and reused once a reader
+// is removed.
+
+#define CR14_GENL_NAME "cr14"
+#define CR14_GENL_VERSION 1
+
+#define CR14_GENL_MCGRP_ARRIVAL_NAME "arrival"
+#define CR14_GENL_MCGRP_DEPARTURE_NAME "departure"
+#define CR14_GENL_MCGRP_COMMAND_NAME "command"
+
+enum cr14_genl_commands {
+	CR14_CMD_UNSPEC,
+	// A chip arrived on the reader.
+	// Attributes: READER, UID, MODEL, TIMESTAMP
+	CR14_CMD_TAG_ARRIVAL,
+	// A chip left the reader.
+	// Attributes: READER, UID, MODEL, TIMESTAMP
+	CR14_CMD_TAG_DEPARTURE,
+	// A command sent to /dev/rfidN completed or was cancelled.
+	// Attributes: READER, UID, TIMESTAMP, COMMAND, STATUS
+	CR14_CMD_COMMAND_COMPLETE,
+	__CR14_CMD_MAX,
+};
+#define CR14_CMD_MAX (__CR14_CMD_MAX - 1)
+
+enum cr14_genl_attrs {
+	CR14_ATTR_UNSPEC,
+	CR14_ATTR_READER, // u32, N of /dev/rfidN
+	CR14_ATTR_UID, // binary, 8 bytes, little endian
+	CR14_ATTR_MODEL, // u32, enum cr14_tag_model
+	CR14_ATTR_TIMESTAMP, // u64, CLOCK_MONOTONIC in nanoseconds
+	CR14_ATTR_COMMAND, // u8, command message header ('r', 'W', ...)
+	CR14_ATTR_STATUS, // s32, 0 or negative errno (-ECANCELED)
+	CR14_ATTR_PAD,
+	__CR14_ATTR_MAX,
+};
+#define CR14_ATTR_MAX (__CR14_ATTR_MAX - 1)
+
+#endif
@@ -0,0 +1,589 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * CR14 RFID Reader Driver - KUnit tests and microbenchmarks
+ *
+ * Copyright (c) 2020 Paul Guyot <pguyot@kallisys.net>
+ */
+
+// This file is included by cr14.c when built with make KUNIT=1, to test
+// static functions. Tests exercise the packet parser of cr14_write, the
+// circular buffer of cr14_write_to_device and cr14_read, and the scheduling of
+// sessions, with a reader that never starts sessions. Its I2C client is only
+// used to log errors. Suites run when the module is loaded on a kernel with
+// CONFIG_KUNIT, results are in the kernel log and in /sys/kernel/debug/kunit.
+
+#include <kunit/test.h>
+#include <linux/mman.h>
+#include <linux/vmalloc.h>
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 10, 0)
+#error "cr14 KUnit tests require Linux 6.10 or later (kunit_vm_mmap)"
+#endif
+
+// Large enough for a whole circular buffer or a packet.
+#define TEST_USER_BUFFER_SIZE PAGE_ALIGN(CIRCULAR_BUFFER_SIZE)
+#define BENCH_ITERATIONS 1000
+
+static const u8 cr14_test_uid[8] = { 0x01, 0x02, 0x03, 0x04,
+				     0x05, 0x0C, 0x02, 0xD0 };
+
+struct cr14_test {
+	struct cr14_i2c_data *priv;
+	struct cr14_client *client;
+	struct file file;
+	char __user *user_buffer;
+};
+
+static int cr14_test_init(struct kunit *test)
+{
+	struct cr14_test *ctx;
+	struct cr14_i2c_data *priv;
+	unsigned long user_buffer;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ctx);
+	test->priv = ctx;
+	priv = vzalloc(sizeof(*priv));
+	KUNIT_ASSERT_NOT_NULL(test, priv);
+	ctx->priv = priv;
+	// Errors such as ring overflows are logged with the device of the client.
+	priv->i2c = kunit_kzalloc(test, sizeof(*priv->i2c), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, priv->i2c);
+
+	timer_setup(&priv->polling_timer, cr14_polling_timer_cb, 0);
+	mutex_init(&priv->command_lock);
+	INIT_LIST_HEAD(&priv->clients);
+	INIT_LIST_HEAD(&priv->batch);
+	seqlock_init(&priv->tags_lock);
+	spin_lock_init(&priv->budget_lock);
+	INIT_WORK(&priv->polling_work, cr14_do_poll);
+	// Completed commands are notified to netlink listeners, if any.
+	spin_lock_init(&priv->genl_lock);
+	INIT_WORK(&priv->genl_work, cr14_genl_work_fn);
+	// Commands are queued but never run.
+	priv->suspended = true;
+	priv->rf_duty_cycle = 100;
+	priv->command_pool = mempool_create_kmalloc_pool(
+		COMMAND_POOL_RESERVE, sizeof(struct cr14_command));
+	KUNIT_ASSERT_NOT_NULL(test, priv->command_pool);
+
+	ctx->client = cr14_client_create(priv, mode_idle, priority_interactive);
+	KUNIT_ASSERT_NOT_NULL(test, ctx->client);
+	ctx->file.private_data = ctx->client;
+
+	user_buffer = kunit_vm_mmap(test, NULL, 0, TEST_USER_BUFFER_SIZE,
+				    PROT_READ | PROT_WRITE,
+				    MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	KUNIT_ASSERT_FALSE(test, IS_ERR_VALUE(user_buffer));
+	ctx->user_buffer = (char __user *)user_buffer;
+	return 0;
+}
+
+static void cr14_test_exit(struct kunit *test)
+{
+	struct cr14_test *ctx = test->priv;
+	if (!ctx || !ctx->priv) {
+		return;
+	}
+	if (ctx->client) {
+		cr14_client_destroy(ctx->client);
+	}
+	cancel_work_sync(&ctx->priv->genl_work);
+	mempool_destroy(ctx->priv->command_pool);
+	vfree(ctx->priv);
+}
+
+// Write bytes to the device with a single write call, as a process would.
+static ssize_t cr14_test_write(struct kunit *test, const void *data,
+			       size_t len)
+{
+	struct cr14_test *ctx = test->priv;
+	loff_t pos = 0;
+	KUNIT_ASSERT_LE(test, len, TEST_USER_BUFFER_SIZE);
+	KUNIT_ASSERT_EQ(test, copy_to_user(ctx->user_buffer, data, len), 0);
+	return cr14_write(&ctx->file, ctx->user_buffer, len, &pos);
+}
+
+// Read bytes from the device with a single read call. Device must have data.
+static ssize_t cr14_test_read(struct kunit *test, void *data, size_t len)
+{
+	struct cr14_test *ctx = test->priv;
+	loff_t pos = 0;
+	ssize_t result;
+	KUNIT_ASSERT_LE(test, len, TEST_USER_BUFFER_SIZE);
+	result = cr14_read(&ctx->file, ctx->user_buffer, len, &pos);
+	if (result > 0) {
+		KUNIT_ASSERT_EQ(test,
+				copy_from_user(data, ctx->user_buffer, result),
+				0);
+	}
+	return result;
+}
+
+static struct cr14_command *cr14_test_first_command(struct kunit *test)
+{
+	struct cr14_test *ctx = test->priv;
+	struct cr14_command *cmd = list_first_entry_or_null(
+		&ctx->client->commands, struct cr14_command, list);
+	KUNIT_ASSERT_NOT_NULL(test, cmd);
+	return cmd;
+}
+
+static void cr14_test_cancel_commands(struct kunit *test)
+{
+	struct cr14_test *ctx = test->priv;
+	mutex_lock(&ctx->priv->command_lock);
+	cr14_cancel_commands(ctx->priv, ctx->client);
+	mutex_unlock(&ctx->priv->command_lock);
+}
+
+// Build a write multiple blocks packet with count addresses.
+// Return packet length.
+static int cr14_test_write_multiple_packet(u8 *packet, int count)
+{
+	int ix;
+	packet[0] = MESSAGE_WRITE_MULTIPLE_BLOCKS_HEADER;
+	memcpy(packet + 1, cr14_test_uid, 8);
+	packet[9] = count;
+	for (ix = 0; ix < count; ix++) {
+		packet[10 + ix] = ix;
+		packet[10 + count + (ix * 4)] = ix;
+		packet[10 + count + (ix * 4) + 1] = ~ix;
+		packet[10 + count + (ix * 4) + 2] = 0x5A;
+		packet[10 + count + (ix * 4) + 3] = 0xA5;
+	}
+	return 10 + (count * 5);
+}
+
+// ========================================================================== //
+// Packet parser
+// ========================================================================== //
+
+static void cr14_test_split_write(struct kunit *test)
+{
+	struct cr14_test *ctx = test->priv;
+	struct cr14_command *cmd;
+	u8 packet[10];
+	int ix;
+
+	packet[0] = MESSAGE_READ_SINGLE_BLOCK_HEADER;
+	memcpy(packet + 1, cr14_test_uid, 8);
+	packet[9] = 0x42;
+	for (ix = 0; ix < sizeof(packet); ix++) {
+		KUNIT_EXPECT_EQ(test, ctx->client->queued_commands, 0);
+		KUNIT_ASSERT_EQ(test, cr14_test_write(test, packet + ix, 1), 1);
+	}
+	KUNIT_EXPECT_EQ(test, ctx->client->write_offset, 0);
+	KUNIT_ASSERT_EQ(test, ctx->client->queued_commands, 1);
+	cmd = cr14_test_first_command(test);
+	KUNIT_EXPECT_EQ(test, cmd->mode, mode_read_single_block);
+	KUNIT_EXPECT_MEMEQ(test, cmd->params.read_single_block.chip_uid,
+			   cr14_test_uid, 8);
+	KUNIT_EXPECT_EQ(test, cmd->params.read_single_block.addr, 0x42);
+}
+
+// Split variable-size packet before, at and after the count byte.
+static void cr14_test_split_variable_write(struct kunit *test)
+{
+	static const int splits[] = { 1, 8, 1, 3, 4, 18 };
+	struct cr14_test *ctx = test->priv;
+	struct cr14_command *cmd;
+	u8 packet[10 + (5 * 5)];
+	int offset = 0;
+	int ix;
+
+	KUNIT_ASSERT_EQ(test, cr14_test_write_multiple_packet(packet, 5),
+			sizeof(packet));
+	for (ix = 0; ix < ARRAY_SIZE(splits); ix++) {
+		KUNIT_ASSERT_EQ(test,
+				cr14_test_write(test, packet + offset,
+						splits[ix]),
+				splits[ix]);
+		offset += splits[ix];
+	}
+	KUNIT_ASSERT_EQ(test, offset, sizeof(packet));
+	KUNIT_EXPECT_EQ(test, ctx->client->write_offset, 0);
+	KUNIT_ASSERT_EQ(test, ctx->client->queued_commands, 1);
+	cmd = cr14_test_first_command(test);
+	KUNIT_EXPECT_EQ(test, cmd->mode, mode_write_multiple_blocks);
+	KUNIT_EXPECT_EQ(test, cmd->params.write_multiple_blocks.addresses_count,
+			5);
+	KUNIT_EXPECT_MEMEQ(test, cmd->params.write_multiple_blocks.addr,
+			   packet + 10, 5);
+	KUNIT_EXPECT_MEMEQ(test, cmd->params.write_multiple_blocks.data,
+			   packet + 15, 20);
+}
+
+static void cr14_test_max_write_multiple(struct kunit *test)
+{
+	struct cr14_test *ctx = test->priv;
+	struct cr14_command *cmd;
+	u8 *packet;
+	int len;
+
+	packet = kunit_kzalloc(test, MAX_PACKET_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, packet);
+	len = cr14_test_write_multiple_packet(packet, 255);
+	KUNIT_ASSERT_EQ(test, len, MAX_PACKET_SIZE);
+	KUNIT_ASSERT_EQ(test, cr14_test_write(test, packet, len), len);
+	KUNIT_ASSERT_EQ(test, ctx->client->queued_commands, 1);
+	cmd = cr14_test_first_command(test);
+	KUNIT_EXPECT_EQ(test, cmd->params.write_multiple_blocks.addresses_count,
+			255);
+	KUNIT_EXPECT_MEMEQ(test, cmd->params.write_multiple_blocks.addr,
+			   packet + 10, 255);
+	KUNIT_EXPECT_MEMEQ(test, cmd->params.write_multiple_blocks.data,
+			   packet + 10 + 255, 255 * 4);
+}
+
+// Only the first packet of a write is consumed.
+static void cr14_test_packets_in_single_write(struct kunit *test)
+{
+	struct cr14_test *ctx = test->priv;
+	u8 buffer[11];
+
+	buffer[0] = MESSAGE_READ_SINGLE_BLOCK_HEADER;
+	memcpy(buffer + 1, cr14_test_uid, 8);
+	buffer[9] = 0x01;
+	buffer[10] = MESSAGE_POLL_REPEAT_MODE_HEADER;
+	KUNIT_EXPECT_EQ(test, cr14_test_write(test, buffer, sizeof(buffer)),
+			10);
+	KUNIT_EXPECT_EQ(test, ctx->client->queued_commands, 1);
+	// Sending a command cancels polling, polling cancels commands.
+	KUNIT_EXPECT_EQ(test, cr14_test_write(test, buffer + 10, 1), 1);
+	KUNIT_EXPECT_EQ(test, ctx->client->queued_commands, 0);
+	KUNIT_EXPECT_EQ(test, ctx->client->mode, mode_poll_repeat);
+}
+
+static void cr14_test_range_packets(struct kunit *test)
+{
+	struct cr14_test *ctx = test->priv;
+	struct cr14_command *cmd;
+	u8 packet[12 + (3 * 4)];
+	int ix;
+
+	packet[0] = MESSAGE_WRITE_RANGE_HEADER;
+	memcpy(packet + 1, cr14_test_uid, 8);
+	packet[9] = 7;
+	packet[10] = 3;
+	packet[11] = 2;
+	for (ix = 0; ix < 12; ix++) {
+		packet[12 + ix] = ix;
+	}
+	// Count is in the fixed part, data is split.
+	KUNIT_ASSERT_EQ(test, cr14_test_write(test, packet, 14), 14);
+	KUNIT_ASSERT_EQ(test, cr14_test_write(test, packet + 14, 10), 10);
+	KUNIT_ASSERT_EQ(test, ctx->client->queued_commands, 1);
+	cmd = cr14_test_first_command(test);
+	KUNIT_EXPECT_EQ(test, cmd->mode, mode_write_range);
+	KUNIT_EXPECT_EQ(test, cmd->params.write_multiple_blocks.addresses_count,
+			3);
+	KUNIT_EXPECT_EQ(test, cmd->params.write_multiple_blocks.addr[0], 7);
+	KUNIT_EXPECT_EQ(test, cmd->params.write_multiple_blocks.addr[2], 11);
+	KUNIT_EXPECT_MEMEQ(test, cmd->params.write_multiple_blocks.data,
+			   packet + 12, 12);
+
+	// Range past block 255 is rejected and parser is reset.
+	packet[0] = MESSAGE_READ_RANGE_HEADER;
+	packet[9] = 250;
+	packet[10] = 4;
+	packet[11] = 2;
+	KUNIT_EXPECT_EQ(test, cr14_test_write(test, packet, 12), -EINVAL);
+	KUNIT_EXPECT_EQ(test, ctx->client->write_offset, 0);
+	KUNIT_EXPECT_EQ(test, ctx->client->queued_commands, 1);
+}
+
+// ========================================================================== //
+// Circular buffer
+// ========================================================================== //
+
+static void cr14_test_ring_partial_read(struct kunit *test)
+{
+	struct cr14_test *ctx = test->priv;
+	u8 message[9];
+	u8 data[9];
+
+	message[0] = MESSAGE_UID_HEADER;
+	memcpy(message + 1, cr14_test_uid, 8);
+	cr14_write_to_device(ctx->client, sizeof(message), message);
+	KUNIT_ASSERT_EQ(test, cr14_test_read(test, data, 4), 4);
+	KUNIT_ASSERT_EQ(test, cr14_test_read(test, data + 4, 16), 5);
+	KUNIT_EXPECT_MEMEQ(test, data, message, sizeof(message));
+	KUNIT_EXPECT_EQ(test, ctx->client->read_buffer_head,
+			ctx->client->read_buffer_tail);
+}
+
+static void cr14_test_ring_wrap(struct kunit *test)
+{
+	struct cr14_test *ctx = test->priv;
+	u8 message[9];
+	u8 data[9];
+	int ix;
+
+	ctx->client->read_buffer_head = CIRCULAR_BUFFER_SIZE - 3;
+	ctx->client->read_buffer_tail = CIRCULAR_BUFFER_SIZE - 3;
+	for (ix = 0; ix < sizeof(message); ix++) {
+		message[ix] = 0xF0 + ix;
+	}
+	cr14_write_to_device(ctx->client, sizeof(message), message);
+	KUNIT_EXPECT_EQ(test, ctx->client->read_buffer_head, 6);
+	KUNIT_ASSERT_EQ(test, cr14_test_read(test, data, sizeof(data)),
+			sizeof(data));
+	KUNIT_EXPECT_MEMEQ(test, data, message, sizeof(message));
+	KUNIT_EXPECT_EQ(test, ctx->client->read_buffer_tail, 6);
+}
+
+// Messages that do not fit are dropped as a whole.
+static void cr14_test_ring_overflow(struct kunit *test)
+{
+	struct cr14_test *ctx = test->priv;
+	int fill = CIRCULAR_BUFFER_SIZE - 5;
+	u8 message[9];
+	u8 *data;
+	s64 drops;
+
+	data = kunit_kzalloc(test, CIRCULAR_BUFFER_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, data);
+	memset(message, 0x77, sizeof(message));
+	cr14_write_to_device(ctx->client, fill, data);
+	KUNIT_ASSERT_EQ(test, ctx->client->read_buffer_head, fill);
+
+	drops = atomic64_read(&ctx->priv->stats.ring_drops);
+	cr14_write_to_device(ctx->client, sizeof(message), message);
+	KUNIT_EXPECT_EQ(test, ctx->client->read_buffer_head, fill);
+	KUNIT_EXPECT_EQ(test, atomic64_read(&ctx->priv->stats.ring_drops),
+			drops + 1);
+
+	// Exactly fills the buffer.
+	cr14_write_to_device(ctx->client, 4, message);
+	KUNIT_EXPECT_EQ(test,
+			CIRC_SPACE(ctx->client->read_buffer_head,
+				   ctx->client->read_buffer_tail,
+				   CIRCULAR_BUFFER_SIZE),
+			0);
+	KUNIT_ASSERT_EQ(test, cr14_test_read(test, data, CIRCULAR_BUFFER_SIZE),
+			CIRCULAR_BUFFER_SIZE - 1);
+	KUNIT_EXPECT_MEMEQ(test, data + fill, message, 4);
+}
+
+// ========================================================================== //
+// Scheduling
+// ========================================================================== //
+
+// Queue read single block packets for blocks 0 to count - 1.
+static void cr14_test_queue_reads(struct kunit *test, int count)
+{
+	u8 packet[10];
+	int ix;
+
+	packet[0] = MESSAGE_READ_SINGLE_BLOCK_HEADER;
+	memcpy(packet + 1, cr14_test_uid, 8);
+	for (ix = 0; ix < count; ix++) {
+		packet[9] = ix;
+		KUNIT_ASSERT_EQ(test, cr14_test_write(test, packet, 10), 10);
+	}
+}
+
+// Schedule a session and end it as cr14_do_poll does, completing the commands
+// of its batch if complete is true, as if their chip answered.
+// Return whether another session is needed.
+static bool cr14_test_session(struct kunit *test, bool complete,
+			      unsigned long *delay)
+{
+	struct cr14_test *ctx = test->priv;
+	struct cr14_i2c_data *priv = ctx->priv;
+	struct cr14_command *cmd, *tmp;
+	s64 completed = atomic64_read(&priv->stats.commands_completed);
+
+	mutex_lock(&priv->command_lock);
+	cr14_schedule_batch(priv);
+	mutex_unlock(&priv->command_lock);
+	KUNIT_EXPECT_FALSE(test, list_empty(&priv->batch));
+	if (complete) {
+		list_for_each_entry_safe(cmd, tmp, &priv->batch, list) {
+			cr14_complete_command(priv, cmd);
+		}
+	}
+	return cr14_end_batch(priv, completed, delay);
+}
+
+// Pipelined commands run in back to back sessions.
+static void cr14_test_pipelined_commands(struct kunit *test)
+{
+	struct cr14_test *ctx = test->priv;
+	unsigned long delay;
+	int ix;
+
+	cr14_test_queue_reads(test, 4);
+	KUNIT_ASSERT_EQ(test, ctx->client->queued_commands, 4);
+	for (ix = 3; ix > 0; ix--) {
+		KUNIT_EXPECT_TRUE(test, cr14_test_session(test, true, &delay));
+		KUNIT_EXPECT_EQ(test, delay, 0);
+		KUNIT_EXPECT_EQ(test, ctx->client->queued_commands, ix);
+	}
+	// Client is idle once its last command completed.
+	KUNIT_EXPECT_FALSE(test, cr14_test_session(test, true, &delay));
+	KUNIT_EXPECT_EQ(test, ctx->client->queued_commands, 0);
+	KUNIT_EXPECT_EQ(test,
+			atomic64_read(&ctx->priv->stats.commands_completed), 4);
+}
+
+// Commands that did not complete, e.g. as their chip is absent, wait for the
+// polling period and keep their order.
+static void cr14_test_stalled_commands(struct kunit *test)
+{
+	struct cr14_test *ctx = test->priv;
+	unsigned long delay;
+
+	cr14_test_queue_reads(test, 2);
+	KUNIT_EXPECT_TRUE(test, cr14_test_session(test, false, &delay));
+	KUNIT_EXPECT_EQ(test, delay, HZ / POLLING_TIMEOUT_SECS_DIV);
+	KUNIT_EXPECT_TRUE(test, list_empty(&ctx->priv->batch));
+	KUNIT_EXPECT_EQ(test, ctx->client->queued_commands, 2);
+	KUNIT_EXPECT_EQ(
+		test,
+		cr14_test_first_command(test)->params.read_single_block.addr,
+		0);
+}
+
+static struct kunit_case cr14_test_cases[] = {
+	KUNIT_CASE(cr14_test_split_write),
+	KUNIT_CASE(cr14_test_split_variable_write),
+	KUNIT_CASE(cr14_test_max_write_multiple),
+	KUNIT_CASE(cr14_test_packets_in_single_write),
+	KUNIT_CASE(cr14_test_range_packets),
+	KUNIT_CASE(cr14_test_ring_partial_read),
+	KUNIT_CASE(cr14_test_ring_wrap),
+	KUNIT_CASE(cr14_test_ring_overflow),
+	KUNIT_CASE(cr14_test_pipelined_commands),
+	KUNIT_CASE(cr14_test_stalled_commands),
+	{}
+};
+
+static struct kunit_suite cr14_test_suite = {
+	.name = "cr14",
+	.init = cr14_test_init,
+	.exit = cr14_test_exit,
+	.test_cases = cr14_test_cases,
+};
+
+// ========================================================================== //
+// Microbenchmarks
+// ========================================================================== //
+
+// Report a duration per unit, with three decimals.
+static void cr14_bench_report(struct kunit *test, const char *name, u64 ns,
+			      u64 units, const char *unit)
+{
+	u64 ps = div64_u64(ns * 1000, units);
+	kunit_info(test, "%s: %llu.%03llu ns/%s\n", name, div_u64(ps, 1000),
+		   ps % 1000, unit);
+}
+
+// Copy messages through the ring: cr14_write_to_device then cr14_read.
+static void cr14_bench_ring(struct kunit *test, int message_size)
+{
+	struct cr14_test *ctx = test->priv;
+	u64 write_ns = 0;
+	u64 read_ns = 0;
+	ktime_t start;
+	loff_t pos = 0;
+	u8 *message;
+	int ix;
+
+	message = kunit_kzalloc(test, message_size, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, message);
+	for (ix = 0; ix < BENCH_ITERATIONS; ix++) {
+		start = ktime_get();
+		cr14_write_to_device(ctx->client, message_size, message);
+		write_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+		start = ktime_get();
+		KUNIT_ASSERT_EQ(test,
+				cr14_read(&ctx->file, ctx->user_buffer,
+					  message_size, &pos),
+				message_size);
+		read_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	}
+	kunit_info(test, "%d bytes messages\n", message_size);
+	cr14_bench_report(test, "cr14_write_to_device", write_ns,
+			  (u64)message_size * BENCH_ITERATIONS, "byte");
+	cr14_bench_report(test, "cr14_read", read_ns,
+			  (u64)message_size * BENCH_ITERATIONS, "byte");
+}
+
+static void cr14_bench_ring_uid(struct kunit *test)
+{
+	cr14_bench_ring(test, 9);
+}
+
+static void cr14_bench_ring_max_response(struct kunit *test)
+{
+	cr14_bench_ring(test, RESPONSE_MAX_SIZE);
+}
+
+// Parse packets with cr14_write, in batches below the queue limit.
+static void cr14_bench_parse(struct kunit *test, const u8 *packet, int len)
+{
+	struct cr14_test *ctx = test->priv;
+	u64 ns = 0;
+	ktime_t start;
+	loff_t pos = 0;
+	int ix;
+	int batch;
+
+	KUNIT_ASSERT_EQ(test, copy_to_user(ctx->user_buffer, packet, len), 0);
+	for (ix = 0; ix < BENCH_ITERATIONS;
+	     ix += CLIENT_MAX_QUEUED_COMMANDS) {
+		start = ktime_get();
+		for (batch = 0; batch < CLIENT_MAX_QUEUED_COMMANDS; batch++) {
+			if (cr14_write(&ctx->file, ctx->user_buffer, len,
+				       &pos) != len) {
+				KUNIT_FAIL(test, "packet was not consumed");
+				return;
+			}
+		}
+		ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+		cr14_test_cancel_commands(test);
+	}
+	kunit_info(test, "%d bytes packets\n", len);
+	cr14_bench_report(test, "cr14_write", ns,
+			  round_up(BENCH_ITERATIONS,
+				   CLIENT_MAX_QUEUED_COMMANDS),
+			  "packet");
+}
+
+static void cr14_bench_parse_read_single(struct kunit *test)
+{
+	u8 packet[10];
+	packet[0] = MESSAGE_READ_SINGLE_BLOCK_HEADER;
+	memcpy(packet + 1, cr14_test_uid, 8);
+	packet[9] = 0;
+	cr14_bench_parse(test, packet, sizeof(packet));
+}
+
+static void cr14_bench_parse_max_write_multiple(struct kunit *test)
+{
+	u8 *packet;
+	int len;
+	packet = kunit_kzalloc(test, MAX_PACKET_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, packet);
+	len = cr14_test_write_multiple_packet(packet, 255);
+	cr14_bench_parse(test, packet, len);
+}
+
+static struct kunit_case cr14_bench_cases[] = {
+	KUNIT_CASE(cr14_bench_ring_uid),
+	KUNIT_CASE(cr14_bench_ring_max_response),
+	KUNIT_CASE(cr14_bench_parse_read_single),
+	KUNIT_CASE(cr14_bench_parse_max_write_multiple),
+	{}
+};
+
+static struct kunit_suite cr14_bench_suite = {
+	.name = "cr14_bench",
+	.init = cr14_test_init,
+	.exit = cr14_test_exit,
+	.test_cases = cr14_bench_cases,
+};
+
+kunit_test_suites(&cr14_test_suite, &cr14_bench_suite);
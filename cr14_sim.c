@@ -0,0 +1,665 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * CR14 RFID Reader Emulator
+ *
+ * Copyright (c) 2020 Paul Guyot <pguyot@kallisys.net>
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/i2c.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/version.h>
+
+// This module registers an I2C adapter with a simulated CR14 at address 0x50
+// and instantiates a cr14 device on it, so cr14.ko runs unmodified without
+// hardware. The emulator implements the parameter, I/O frame and slot marker
+// registers and the SR protocol (initiate, PCALL16 and slot markers, select,
+// get UID, read block, write block, reset to inventory and completion) for a
+// population of tags, with a timing model: the frame register is not
+// acknowledged until the simulated RF exchange is over.
+//
+// Tags are added and removed by writing lines to debugfs file
+// cr14_sim/tags:
+//      add <uid in big endian> [crc=<percent>] [miss=<percent>] [blocks=<n>]
+//      del <uid in big endian>
+//      clear
+// crc and miss are the probability that a reply of the tag has a CRC error or
+// is not received, to emulate badly placed or damaged tags. blocks is the
+// number of 32 bits blocks (default 128), block 255 (system block) is always
+// present. Reading the file lists the tags and their state.
+
+#define DRV_NAME "cr14_sim"
+
+#define CR14_SIM_ADDRESS 0x50
+#define CR14_SIM_MAX_TAGS 128
+#define CR14_SIM_MAX_BLOCKS 128
+#define CR14_SIM_SYSTEM_BLOCK 255
+
+#define CRX14_PARAMETER_REGISTER 0x00
+#define CRX14_IO_FRAME_REGISTER 0x01
+#define CRX14_SLOT_MARKER_REGISTER 0x03
+
+#define CARRIER_FREQ_RF_OUT_ON 0x10
+
+#define COMMAND_INITIATE_H 0x06
+#define COMMAND_INITIATE_L 0x00
+#define COMMAND_READ_BLOCK_H 0x08
+#define COMMAND_WRITE_BLOCK_H 0x09
+#define COMMAND_GET_UID 0x0B
+#define COMMAND_RESET_TO_INVENTORY 0x0C
+#define COMMAND_SELECT_H 0x0E
+#define COMMAND_COMPLETION 0x0F
+
+// Frame register answers
+#define FRAME_NO_REPLY 0x00
+#define FRAME_ERROR 0xFF // CRC error or collision
+
+// Timing model, at 106 kbps: 10 ETUs per byte, plus CRC, SOF and EOF.
+#define ETU_NS 9440
+#define T0_NS (64 * ETU_NS) // tag reply delay
+#define WATCHDOG_NS 500000
+#define WRITE_BLOCK_NS 7000000 // EEPROM programming, worst case
+
+static bool timing = true;
+module_param(timing, bool, 0644);
+MODULE_PARM_DESC(timing, "Delay answers like a real CR14 (default: Y)");
+
+enum cr14_sim_tag_state {
+	tag_power_off,
+	tag_ready,
+	tag_inventory,
+	tag_selected,
+	tag_deselected,
+	tag_deactivated,
+};
+
+static const char *const cr14_sim_tag_state_names[] = {
+	[tag_power_off] = "power-off",	 [tag_ready] = "ready",
+	[tag_inventory] = "inventory",	 [tag_selected] = "selected",
+	[tag_deselected] = "deselected", [tag_deactivated] = "deactivated",
+};
+
+struct cr14_sim_tag {
+	u8 uid[8]; // little endian
+	enum cr14_sim_tag_state state;
+	u8 chip_id;
+	unsigned int crc_percent;
+	unsigned int miss_percent;
+	unsigned int blocks;
+	u8 memory[CR14_SIM_MAX_BLOCKS * 4];
+	u8 system_block[4];
+};
+
+struct cr14_sim {
+	struct i2c_adapter adapter;
+	struct i2c_client *client;
+	struct dentry *debugfs;
+	struct mutex lock; // locks registers and tags
+	u8 parameter;
+	u8 frame[I2C_SMBUS_BLOCK_MAX]; // answer in I/O frame register
+	ktime_t ready; // frame register is busy until then
+	int tags_count;
+	struct cr14_sim_tag tags[CR14_SIM_MAX_TAGS];
+};
+
+static struct cr14_sim *cr14_sim;
+
+// ========================================================================== //
+// SR protocol
+// ========================================================================== //
+
+static u64 cr14_sim_frame_ns(int bytes)
+{
+	return (u64)(bytes + 2) * 10 * ETU_NS + 26 * ETU_NS;
+}
+
+static u64 cr14_sim_reply_ns(int bytes)
+{
+	if (bytes == 0) {
+		return WATCHDOG_NS;
+	}
+	return T0_NS + cr14_sim_frame_ns(bytes);
+}
+
+static bool cr14_sim_roll(unsigned int percent)
+{
+	return percent && (get_random_u32() % 100) < percent;
+}
+
+static bool cr14_sim_rf_on(struct cr14_sim *sim)
+{
+	return sim->parameter & CARRIER_FREQ_RF_OUT_ON;
+}
+
+// Write the answer of a single tag to the frame register, applying its error
+// rates. Return the number of bytes received by the CR14.
+static int cr14_sim_reply(struct cr14_sim *sim, struct cr14_sim_tag *tag,
+			  const u8 *data, int len)
+{
+	memset(sim->frame, 0, sizeof(sim->frame));
+	if (cr14_sim_roll(tag->miss_percent)) {
+		sim->frame[0] = FRAME_NO_REPLY;
+		return 0;
+	}
+	if (cr14_sim_roll(tag->crc_percent)) {
+		sim->frame[0] = FRAME_ERROR;
+		return len;
+	}
+	sim->frame[0] = len;
+	memcpy(sim->frame + 1, data, len);
+	return len;
+}
+
+static struct cr14_sim_tag *cr14_sim_selected_tag(struct cr14_sim *sim)
+{
+	int ix;
+	for (ix = 0; ix < sim->tags_count; ix++) {
+		if (sim->tags[ix].state == tag_selected) {
+			return &sim->tags[ix];
+		}
+	}
+	return NULL;
+}
+
+static u8 *cr14_sim_block(struct cr14_sim_tag *tag, u8 addr)
+{
+	if (addr == CR14_SIM_SYSTEM_BLOCK) {
+		return tag->system_block;
+	}
+	if (addr < tag->blocks) {
+		return tag->memory + (addr * 4);
+	}
+	return NULL;
+}
+
+// Initiate: tags enter inventory with a random chip id and answer with it.
+static u64 cr14_sim_initiate(struct cr14_sim *sim)
+{
+	struct cr14_sim_tag *answer = NULL;
+	int answers = 0;
+	int len = 0;
+	int ix;
+	for (ix = 0; ix < sim->tags_count; ix++) {
+		struct cr14_sim_tag *tag = &sim->tags[ix];
+		if (tag->state == tag_ready || tag->state == tag_inventory) {
+			tag->state = tag_inventory;
+			tag->chip_id = get_random_u32();
+			answer = tag;
+			answers++;
+		}
+	}
+	memset(sim->frame, 0, sizeof(sim->frame));
+	if (answers == 1) {
+		len = cr14_sim_reply(sim, answer, &answer->chip_id, 1);
+	} else if (answers > 1) {
+		sim->frame[0] = FRAME_ERROR;
+		len = 1;
+	}
+	return cr14_sim_frame_ns(2) + cr14_sim_reply_ns(len);
+}
+
+// Slot marker register: PCALL16 followed by 15 slot markers. Tags in inventory
+// pick a new chip id and answer in the slot of its 4 low bits.
+// Answer is the mask of slots with a valid answer and the chip id of each slot
+// (FRAME_ERROR on collision or CRC error).
+static u64 cr14_sim_slot_markers(struct cr14_sim *sim)
+{
+	int answers[16] = { 0 };
+	u8 chip_ids[16] = { 0 };
+	u16 mask = 0;
+	u64 ns = 0;
+	int slot;
+	int ix;
+	for (ix = 0; ix < sim->tags_count; ix++) {
+		struct cr14_sim_tag *tag = &sim->tags[ix];
+		if (tag->state != tag_inventory) {
+			continue;
+		}
+		tag->chip_id = get_random_u32();
+		slot = tag->chip_id & 0x0F;
+		if (cr14_sim_roll(tag->miss_percent)) {
+			continue;
+		}
+		answers[slot]++;
+		chip_ids[slot] = cr14_sim_roll(tag->crc_percent) ? FRAME_ERROR :
+								  tag->chip_id;
+	}
+	for (slot = 0; slot < 16; slot++) {
+		ns += cr14_sim_frame_ns(slot == 0 ? 2 : 1);
+		if (answers[slot] == 0) {
+			ns += cr14_sim_reply_ns(0);
+			continue;
+		}
+		ns += cr14_sim_reply_ns(1);
+		if (answers[slot] > 1) {
+			chip_ids[slot] = FRAME_ERROR;
+		} else if (chip_ids[slot] != FRAME_ERROR) {
+			mask |= 1 << slot;
+		}
+	}
+	memset(sim->frame, 0, sizeof(sim->frame));
+	sim->frame[0] = 18;
+	sim->frame[1] = mask & 0xFF;
+	sim->frame[2] = mask >> 8;
+	memcpy(sim->frame + 3, chip_ids, 16);
+	return ns;
+}
+
+static u64 cr14_sim_select(struct cr14_sim *sim, u8 chip_id)
+{
+	struct cr14_sim_tag *answer = NULL;
+	int answers = 0;
+	int len = 0;
+	int ix;
+	for (ix = 0; ix < sim->tags_count; ix++) {
+		struct cr14_sim_tag *tag = &sim->tags[ix];
+		if (tag->state != tag_inventory &&
+		    tag->state != tag_selected &&
+		    tag->state != tag_deselected) {
+			continue;
+		}
+		if (tag->chip_id == chip_id) {
+			tag->state = tag_selected;
+			answer = tag;
+			answers++;
+		} else if (tag->state == tag_selected) {
+			tag->state = tag_deselected;
+		}
+	}
+	memset(sim->frame, 0, sizeof(sim->frame));
+	if (answers == 1) {
+		len = cr14_sim_reply(sim, answer, &chip_id, 1);
+	} else if (answers > 1) {
+		sim->frame[0] = FRAME_ERROR;
+		len = 1;
+	}
+	return cr14_sim_frame_ns(2) + cr14_sim_reply_ns(len);
+}
+
+// Process a frame written to the I/O frame register.
+// Return duration of the RF exchange.
+static u64 cr14_sim_process_frame(struct cr14_sim *sim, const u8 *frame,
+				  int len)
+{
+	struct cr14_sim_tag *tag;
+	int reply = 0;
+	u8 *block;
+
+	memset(sim->frame, 0, sizeof(sim->frame));
+	if (!cr14_sim_rf_on(sim) || len == 0) {
+		return 0;
+	}
+	if (frame[0] == COMMAND_INITIATE_H && len == 2 &&
+	    frame[1] == COMMAND_INITIATE_L) {
+		return cr14_sim_initiate(sim);
+	}
+	if (frame[0] == COMMAND_SELECT_H && len == 2) {
+		return cr14_sim_select(sim, frame[1]);
+	}
+	tag = cr14_sim_selected_tag(sim);
+	switch (frame[0]) {
+	case COMMAND_GET_UID:
+		if (tag) {
+			reply = cr14_sim_reply(sim, tag, tag->uid, 8);
+		}
+		break;
+	case COMMAND_READ_BLOCK_H:
+		if (tag && len == 2) {
+			block = cr14_sim_block(tag, frame[1]);
+			if (block) {
+				reply = cr14_sim_reply(sim, tag, block, 4);
+			}
+		}
+		break;
+	case COMMAND_WRITE_BLOCK_H:
+		if (tag && len == 6) {
+			block = cr14_sim_block(tag, frame[1]);
+			if (block) {
+				memcpy(block, frame + 2, 4);
+			}
+			return cr14_sim_frame_ns(len) + WRITE_BLOCK_NS;
+		}
+		break;
+	case COMMAND_RESET_TO_INVENTORY:
+		if (tag) {
+			tag->state = tag_inventory;
+		}
+		break;
+	case COMMAND_COMPLETION:
+		if (tag) {
+			tag->state = tag_deactivated;
+		}
+		break;
+	}
+	return cr14_sim_frame_ns(len) + cr14_sim_reply_ns(reply);
+}
+
+static void cr14_sim_set_parameter(struct cr14_sim *sim, u8 value)
+{
+	bool was_on = cr14_sim_rf_on(sim);
+	int ix;
+	sim->parameter = value;
+	if (was_on == cr14_sim_rf_on(sim)) {
+		return;
+	}
+	// Tags are powered by the field.
+	for (ix = 0; ix < sim->tags_count; ix++) {
+		sim->tags[ix].state = was_on ? tag_power_off : tag_ready;
+	}
+	memset(sim->frame, 0, sizeof(sim->frame));
+}
+
+static void cr14_sim_busy(struct cr14_sim *sim, u64 ns)
+{
+	sim->ready = timing ? ktime_add_ns(ktime_get(), ns) : 0;
+}
+
+// ========================================================================== //
+// I2C adapter
+// ========================================================================== //
+
+static s32 cr14_sim_xfer(struct i2c_adapter *adapter, u16 addr,
+			 unsigned short flags, char read_write, u8 command,
+			 int size, union i2c_smbus_data *data)
+{
+	struct cr14_sim *sim = i2c_get_adapdata(adapter);
+	s32 result = 0;
+	int len;
+
+	if (addr != CR14_SIM_ADDRESS) {
+		return -ENXIO;
+	}
+	mutex_lock(&sim->lock);
+	switch (size) {
+	case I2C_SMBUS_BYTE:
+		if (read_write == I2C_SMBUS_WRITE &&
+		    command == CRX14_SLOT_MARKER_REGISTER &&
+		    cr14_sim_rf_on(sim)) {
+			cr14_sim_busy(sim, cr14_sim_slot_markers(sim));
+		} else {
+			result = -EREMOTEIO;
+		}
+		break;
+	case I2C_SMBUS_BYTE_DATA:
+		if (command != CRX14_PARAMETER_REGISTER) {
+			// Also ST25R identification register.
+			result = -EREMOTEIO;
+		} else if (read_write == I2C_SMBUS_WRITE) {
+			cr14_sim_set_parameter(sim, data->byte);
+		} else {
+			data->byte = sim->parameter;
+		}
+		break;
+	case I2C_SMBUS_I2C_BLOCK_DATA:
+		if (command != CRX14_IO_FRAME_REGISTER) {
+			result = -EREMOTEIO;
+			break;
+		}
+		len = min_t(int, data->block[0], sizeof(sim->frame));
+		if (read_write == I2C_SMBUS_WRITE) {
+			// Length byte followed by the frame.
+			if (len < 1 || data->block[1] != len - 1) {
+				result = -EREMOTEIO;
+				break;
+			}
+			cr14_sim_busy(sim, cr14_sim_process_frame(
+						   sim, data->block + 2, len - 1));
+		} else if (ktime_before(ktime_get(), sim->ready)) {
+			// CR14 does not acknowledge until frame is exchanged.
+			result = -EREMOTEIO;
+		} else {
+			memcpy(data->block + 1, sim->frame, len);
+		}
+		break;
+	default:
+		result = -EOPNOTSUPP;
+	}
+	mutex_unlock(&sim->lock);
+	return result;
+}
+
+static u32 cr14_sim_functionality(struct i2c_adapter *adapter)
+{
+	return I2C_FUNC_SMBUS_BYTE | I2C_FUNC_SMBUS_BYTE_DATA |
+	       I2C_FUNC_SMBUS_I2C_BLOCK;
+}
+
+static const struct i2c_algorithm cr14_sim_algorithm = {
+	.smbus_xfer = cr14_sim_xfer,
+	.functionality = cr14_sim_functionality,
+};
+
+// ========================================================================== //
+// Tag population
+// ========================================================================== //
+
+// Parse a UID in big endian, as displayed by the driver.
+static int cr14_sim_parse_uid(const char *str, u8 *uid)
+{
+	u8 be[8];
+	int ix;
+	if (strlen(str) != 16 || hex2bin(be, str, 8)) {
+		return -EINVAL;
+	}
+	for (ix = 0; ix < 8; ix++) {
+		uid[ix] = be[7 - ix];
+	}
+	return 0;
+}
+
+static int cr14_sim_find_tag(struct cr14_sim *sim, const u8 *uid)
+{
+	int ix;
+	for (ix = 0; ix < sim->tags_count; ix++) {
+		if (memcmp(sim->tags[ix].uid, uid, 8) == 0) {
+			return ix;
+		}
+	}
+	return -1;
+}
+
+// Called with lock held.
+static int cr14_sim_add_tag(struct cr14_sim *sim, char *args)
+{
+	struct cr14_sim_tag *tag;
+	char *token;
+	u8 uid[8];
+	int err;
+
+	token = strsep(&args, " ");
+	if (!token || cr14_sim_parse_uid(token, uid)) {
+		return -EINVAL;
+	}
+	if (cr14_sim_find_tag(sim, uid) >= 0) {
+		return -EEXIST;
+	}
+	if (sim->tags_count == CR14_SIM_MAX_TAGS) {
+		return -ENOSPC;
+	}
+	tag = &sim->tags[sim->tags_count];
+	memset(tag, 0, sizeof(*tag));
+	memcpy(tag->uid, uid, 8);
+	tag->blocks = CR14_SIM_MAX_BLOCKS;
+	memset(tag->system_block, 0xFF, sizeof(tag->system_block));
+	while ((token = strsep(&args, " ")) != NULL) {
+		if (*token == '\0') {
+			continue;
+		}
+		if (strncmp(token, "crc=", 4) == 0) {
+			err = kstrtouint(token + 4, 10, &tag->crc_percent);
+		} else if (strncmp(token, "miss=", 5) == 0) {
+			err = kstrtouint(token + 5, 10, &tag->miss_percent);
+		} else if (strncmp(token, "blocks=", 7) == 0) {
+			err = kstrtouint(token + 7, 10, &tag->blocks);
+		} else {
+			err = -EINVAL;
+		}
+		if (err) {
+			return err;
+		}
+	}
+	if (tag->crc_percent > 100 || tag->miss_percent > 100 ||
+	    tag->blocks > CR14_SIM_MAX_BLOCKS) {
+		return -EINVAL;
+	}
+	tag->state = cr14_sim_rf_on(sim) ? tag_ready : tag_power_off;
+	sim->tags_count++;
+	return 0;
+}
+
+// Called with lock held.
+static int cr14_sim_del_tag(struct cr14_sim *sim, char *args)
+{
+	u8 uid[8];
+	int ix;
+	if (cr14_sim_parse_uid(strim(args), uid)) {
+		return -EINVAL;
+	}
+	ix = cr14_sim_find_tag(sim, uid);
+	if (ix < 0) {
+		return -ENOENT;
+	}
+	sim->tags_count--;
+	sim->tags[ix] = sim->tags[sim->tags_count];
+	return 0;
+}
+
+static int cr14_sim_tags_show(struct seq_file *s, void *data)
+{
+	struct cr14_sim *sim = s->private;
+	int ix;
+	mutex_lock(&sim->lock);
+	for (ix = 0; ix < sim->tags_count; ix++) {
+		struct cr14_sim_tag *tag = &sim->tags[ix];
+		const u8 *uid = tag->uid;
+		seq_printf(s,
+			   "%02x%02x%02x%02x%02x%02x%02x%02x crc=%u miss=%u blocks=%u %s\n",
+			   uid[7], uid[6], uid[5], uid[4], uid[3], uid[2],
+			   uid[1], uid[0], tag->crc_percent, tag->miss_percent,
+			   tag->blocks, cr14_sim_tag_state_names[tag->state]);
+	}
+	mutex_unlock(&sim->lock);
+	return 0;
+}
+
+static int cr14_sim_tags_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cr14_sim_tags_show, inode->i_private);
+}
+
+static ssize_t cr14_sim_tags_write(struct file *file, const char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	struct cr14_sim *sim = file_inode(file)->i_private;
+	char line[128];
+	char *args;
+	char *verb;
+	int err;
+
+	if (count >= sizeof(line)) {
+		return -EINVAL;
+	}
+	if (copy_from_user(line, buf, count)) {
+		return -EFAULT;
+	}
+	line[count] = '\0';
+	args = strim(line);
+	verb = strsep(&args, " ");
+	mutex_lock(&sim->lock);
+	if (strcmp(verb, "add") == 0 && args) {
+		err = cr14_sim_add_tag(sim, args);
+	} else if (strcmp(verb, "del") == 0 && args) {
+		err = cr14_sim_del_tag(sim, args);
+	} else if (strcmp(verb, "clear") == 0) {
+		sim->tags_count = 0;
+		err = 0;
+	} else {
+		err = -EINVAL;
+	}
+	mutex_unlock(&sim->lock);
+	return err ? err : count;
+}
+
+static const struct file_operations cr14_sim_tags_fops = {
+	.owner = THIS_MODULE,
+	.open = cr14_sim_tags_open,
+	.read = seq_read,
+	.write = cr14_sim_tags_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+// ========================================================================== //
+// Initialization and cleanup
+// ========================================================================== //
+
+static int __init cr14_sim_init(void)
+{
+	struct i2c_board_info info = {
+		I2C_BOARD_INFO("cr14", CR14_SIM_ADDRESS),
+	};
+	struct cr14_sim *sim;
+	int err;
+
+	sim = kvzalloc(sizeof(*sim), GFP_KERNEL);
+	if (!sim) {
+		return -ENOMEM;
+	}
+	mutex_init(&sim->lock);
+	sim->adapter.owner = THIS_MODULE;
+	sim->adapter.algo = &cr14_sim_algorithm;
+	strscpy(sim->adapter.name, "CR14 emulator", sizeof(sim->adapter.name));
+	i2c_set_adapdata(&sim->adapter, sim);
+	err = i2c_add_adapter(&sim->adapter);
+	if (err) {
+		kvfree(sim);
+		return err;
+	}
+	sim->debugfs = debugfs_create_dir(DRV_NAME, NULL);
+	debugfs_create_file("tags", 0600, sim->debugfs, sim,
+			    &cr14_sim_tags_fops);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0)
+	sim->client = i2c_new_device(&sim->adapter, &info);
+	if (!sim->client) {
+		err = -ENODEV;
+	}
+#else
+	sim->client = i2c_new_client_device(&sim->adapter, &info);
+	if (IS_ERR(sim->client)) {
+		err = PTR_ERR(sim->client);
+	}
+#endif
+	if (err) {
+		debugfs_remove_recursive(sim->debugfs);
+		i2c_del_adapter(&sim->adapter);
+		kvfree(sim);
+		return err;
+	}
+	cr14_sim = sim;
+	return 0;
+}
+module_init(cr14_sim_init);
+
+static void __exit cr14_sim_exit(void)
+{
+	struct cr14_sim *sim = cr14_sim;
+	i2c_unregister_device(sim->client);
+	debugfs_remove_recursive(sim->debugfs);
+	i2c_del_adapter(&sim->adapter);
+	kvfree(sim);
+}
+module_exit(cr14_sim_exit);
+
+MODULE_DESCRIPTION("STMicroelectronics CR14 Emulator");
+MODULE_AUTHOR("Paul Guyot <pguyot@kallisys.net>");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * CR14 RFID Reader Driver - tracepoints
+ *
+ * Copyright (c) 2020 Paul Guyot <pguyot@kallisys.net>
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM cr14
+
+#if !defined(_CR14_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _CR14_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// RF session, from scheduling of commands to RF off.
+TRACE_EVENT(cr14_session_start,
+	    TP_PROTO(u32 round_id, int priority),
+	    TP_ARGS(round_id, priority),
+	    TP_STRUCT__entry(__field(u32, round_id) __field(int, priority)),
+	    TP_fast_assign(__entry->round_id = round_id;
+			   __entry->priority = priority;),
+	    TP_printk("round=%u priority=%d", __entry->round_id,
+		      __entry->priority));
+
+TRACE_EVENT(cr14_session_end,
+	    TP_PROTO(u32 round_id, bool complete, int uids),
+	    TP_ARGS(round_id, complete, uids),
+	    TP_STRUCT__entry(__field(u32, round_id) __field(bool, complete)
+				     __field(int, uids)),
+	    TP_fast_assign(__entry->round_id = round_id;
+			   __entry->complete = complete;
+			   __entry->uids = uids;),
+	    TP_printk("round=%u complete=%d uids=%d", __entry->round_id,
+		      __entry->complete, __entry->uids));
+
+TRACE_EVENT(cr14_rf,
+	    TP_PROTO(bool on, int result),
+	    TP_ARGS(on, result),
+	    TP_STRUCT__entry(__field(bool, on) __field(int, result)),
+	    TP_fast_assign(__entry->on = on; __entry->result = result;),
+	    TP_printk("on=%d result=%d", __entry->on, __entry->result));
+
+// Frame written to the frame register: length byte and opcode (first byte
+// sent to the chip).
+TRACE_EVENT(cr14_frame_write,
+	    TP_PROTO(u8 len, u8 opcode, int result),
+	    TP_ARGS(len, opcode, result),
+	    TP_STRUCT__entry(__field(u8, len) __field(u8, opcode)
+				     __field(int, result)),
+	    TP_fast_assign(__entry->len = len; __entry->opcode = opcode;
+			   __entry->result = result;),
+	    TP_printk("len=%u opcode=0x%02x result=%d", __entry->len,
+		      __entry->opcode, __entry->result));
+
+// Frame read from the frame register: status byte (0 if no reply, 255 on CRC
+// error or collision, length otherwise) and retries while CR14 was busy.
+TRACE_EVENT(cr14_frame_read,
+	    TP_PROTO(u8 status, int retries, int result),
+	    TP_ARGS(status, retries, result),
+	    TP_STRUCT__entry(__field(u8, status) __field(int, retries)
+				     __field(int, result)),
+	    TP_fast_assign(__entry->status = status;
+			   __entry->retries = retries;
+			   __entry->result = result;),
+	    TP_printk("status=%u retries=%d result=%d", __entry->status,
+		      __entry->retries, __entry->result));
+
+TRACE_EVENT(cr14_slot_marker,
+	    TP_PROTO(int result),
+	    TP_ARGS(result),
+	    TP_STRUCT__entry(__field(int, result)),
+	    TP_fast_assign(__entry->result = result;),
+	    TP_printk("result=%d", __entry->result));
+
+// Command about to run on selected chip.
+TRACE_EVENT(cr14_command_dispatch,
+	    TP_PROTO(u8 command, const u8 *uid, int priority),
+	    TP_ARGS(command, uid, priority),
+	    TP_STRUCT__entry(__field(u8, command) __array(u8, uid, 8)
+				     __field(int, priority)),
+	    TP_fast_assign(__entry->command = command;
+			   memcpy(__entry->uid, uid, 8);
+			   __entry->priority = priority;),
+	    TP_printk("command=%c uid=%8phN priority=%d", __entry->command,
+		      __entry->uid, __entry->priority));
+
+// Command attempt result: 0 if completed, 1 on collision, other positive
+// values if it will be retried, -ECANCELED if cancelled.
+TRACE_EVENT(cr14_command_complete,
+	    TP_PROTO(u8 command, const u8 *uid, int status),
+	    TP_ARGS(command, uid, status),
+	    TP_STRUCT__entry(__field(u8, command) __array(u8, uid, 8)
+				     __field(int, status)),
+	    TP_fast_assign(__entry->command = command;
+			   memcpy(__entry->uid, uid, 8);
+			   __entry->status = status;),
+	    TP_printk("command=%c uid=%8phN status=%d", __entry->command,
+		      __entry->uid, __entry->status));
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE cr14_trace
+
+#include <trace/define_trace.h>
@@ -2,7 +2,7 @@
 
 import os
 
-# Example code demonstrating how to write several blocks in a row.
+# Example code demonstrating how to fill several blocks in a row.
 # Write FFFFFFFF to blocks 7 to 9 (that may be affected by other scripts)
 
 rfid = os.open("/dev/rfid0", os.O_RDWR)
@@ -21,24 +21,18 @@ try:
         print(f"UID: {uid_str}")
         if uid[0] != 0xD0:
             print(f"Unexpected MSB, got {uid[0]}")
-        erased_data = b"\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF"
-        os.write(rfid, b"W" + uid_le + b"\x03\x07\x08\x09" + erased_data)
+        # Fill 3 blocks from block 7 (stride 1) with FFFFFFFF
+        os.write(rfid, b"f" + uid_le + b"\x07\x03\x01" + b"\xFF\xFF\xFF\xFF")
         packet = os.read(rfid, 1)
         while packet == b"u":
             os.read(rfid, 8)
             packet = os.read(rfid, 1)
-        if packet == b"W":
-            count = os.read(rfid, 1)
-            if count[0] != 3:
-                print(f"Unexpected count, got {count[0]}, expected 3")
+        if packet == b"f":
+            mismatches = os.read(rfid, 1)
+            if mismatches[0] != 0:
+                print(f"{mismatches[0]} blocks were not erased")
             else:
-                data = os.read(rfid, 12)
-                if data != erased_data:
-                    print(
-                        f"Data mismatch, got {data.hex()} but wrote {erased_data.hex()}"
-                    )
-                else:
-                    print("Erased blocks 7 to 9 (wrote FFFFFFFF)")
+                print("Erased blocks 7 to 9 (wrote FFFFFFFF)")
         else:
             print(f"Unexpected packet header {packet[0]}")
 except KeyboardInterrupt:
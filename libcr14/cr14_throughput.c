@@ -0,0 +1,293 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * CR14 RFID Reader Driver - command throughput test
+ *
+ * Copyright (c) 2020 Paul Guyot <pguyot@kallisys.net>
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libcr14.h"
+
+// Wait for a chip at most this long.
+#define UID_TIMEOUT_MS 10000
+// Fail if no response comes for this long.
+#define RESPONSE_TIMEOUT_MS 5000
+
+struct throughput {
+	struct cr14_client *client;
+	char command; // r, R or g
+	unsigned int blocks;
+	unsigned int depth;
+	unsigned int total;
+	unsigned int submitted;
+	unsigned int completed;
+	int status;
+	bool found;
+	uint8_t uid[8];
+	uint8_t addresses[255];
+	uint64_t *submit_ns; // submission time, by command
+	uint64_t latency_sum_ns;
+	uint64_t latency_max_ns;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void on_message(struct cr14_client *client,
+		       const struct cr14_message *message, void *context)
+{
+	struct throughput *test = context;
+	(void)client;
+	if (message->header == 'u' && !test->found) {
+		memcpy(test->uid, message->uid, 8);
+		test->found = true;
+	}
+}
+
+static int submit(struct throughput *test);
+
+static void on_response(struct cr14_client *client, int status,
+			const struct cr14_message *message, void *context)
+{
+	struct throughput *test = context;
+	uint64_t latency;
+	(void)client;
+	(void)message;
+	if (status < 0) {
+		if (test->status == 0) {
+			test->status = status;
+		}
+		return;
+	}
+	latency = now_ns() - test->submit_ns[test->completed];
+	test->latency_sum_ns += latency;
+	if (latency > test->latency_max_ns) {
+		test->latency_max_ns = latency;
+	}
+	test->completed++;
+	if (test->submitted < test->total) {
+		submit(test);
+	}
+}
+
+static int submit(struct throughput *test)
+{
+	int result;
+	test->submit_ns[test->submitted] = now_ns();
+	switch (test->command) {
+	case 'r':
+		result = cr14_read_block(test->client, test->uid, 0, on_response,
+					 test);
+		break;
+	case 'R':
+		result = cr14_read_blocks(test->client, test->uid,
+					  test->addresses, test->blocks,
+					  on_response, test);
+		break;
+	default:
+		result = cr14_read_range(test->client, test->uid, 0,
+					 test->blocks, 1, on_response, test);
+		break;
+	}
+	if (result < 0) {
+		test->status = result;
+	} else {
+		test->submitted++;
+	}
+	return result;
+}
+
+// Process events until done() or timeout without event.
+static int run_loop(struct throughput *test, int epfd,
+		    bool (*done)(const struct throughput *), int timeout_ms)
+{
+	struct epoll_event event = { .data.ptr = test };
+	uint32_t events = 0;
+	int result;
+
+	while (!done(test) && test->status == 0) {
+		uint32_t wanted = EPOLLIN;
+		if (cr14_client_wants_write(test->client)) {
+			wanted |= EPOLLOUT;
+		}
+		if (wanted != events) {
+			event.events = wanted;
+			if (epoll_ctl(epfd, events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+				      cr14_client_fd(test->client), &event)) {
+				return -errno;
+			}
+			events = wanted;
+		}
+		result = epoll_wait(epfd, &event, 1, timeout_ms);
+		if (result < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -errno;
+		}
+		if (result == 0) {
+			return -ETIMEDOUT;
+		}
+		if (event.events & EPOLLIN) {
+			result = cr14_client_process(test->client);
+		} else {
+			result = cr14_client_flush(test->client);
+		}
+		if (result < 0) {
+			return result;
+		}
+	}
+	return test->status;
+}
+
+static bool uid_found(const struct throughput *test)
+{
+	return test->found;
+}
+
+static bool all_completed(const struct throughput *test)
+{
+	return test->completed == test->total;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-d device] [-c r|R|g] [-b blocks] [-q depth] "
+		"[-n commands]\n"
+		"Read blocks of the first chip found and report throughput.\n"
+		"  -d device    reader device (default %s)\n"
+		"  -c command   r (read block), R (read blocks) or g (read "
+		"range) (default g)\n"
+		"  -b blocks    blocks per R or g command (default 16)\n"
+		"  -q depth     commands in flight (default %d)\n"
+		"  -n commands  commands to send (default 100)\n",
+		name, CR14_DEVICE, CR14_MAX_QUEUED_COMMANDS);
+}
+
+int main(int argc, char **argv)
+{
+	struct throughput test = {
+		.command = 'g',
+		.blocks = 16,
+		.depth = CR14_MAX_QUEUED_COMMANDS,
+		.total = 100,
+	};
+	const char *device = CR14_DEVICE;
+	char uid_str[17];
+	uint64_t start, elapsed;
+	unsigned int ix;
+	int epfd;
+	int result;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:c:b:q:n:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'c':
+			test.command = optarg[0];
+			break;
+		case 'b':
+			test.blocks = strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			test.depth = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			test.total = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+	if ((test.command != 'r' && test.command != 'R' &&
+	     test.command != 'g') ||
+	    test.blocks < 1 || test.blocks > 255 || test.depth < 1 ||
+	    test.total < 1) {
+		usage(argv[0]);
+		return 2;
+	}
+	if (test.command == 'r') {
+		test.blocks = 1;
+	}
+	for (ix = 0; ix < test.blocks; ix++) {
+		test.addresses[ix] = ix;
+	}
+	test.submit_ns = calloc(test.total, sizeof(*test.submit_ns));
+	if (!test.submit_ns) {
+		perror("calloc");
+		return 1;
+	}
+
+	test.client = cr14_client_open(device, O_RDWR, on_message, &test);
+	if (!test.client) {
+		perror(device);
+		return 1;
+	}
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		return 1;
+	}
+
+	do {
+		result = cr14_poll_once(test.client);
+		if (result < 0) {
+			break;
+		}
+		result = run_loop(&test, epfd, uid_found, UID_TIMEOUT_MS);
+		if (result < 0) {
+			break;
+		}
+		cr14_uid_format(test.uid, uid_str, sizeof(uid_str));
+		printf("Chip %s (%s)\n", uid_str,
+		       cr14_model_name(cr14_uid_model(test.uid)));
+
+		start = now_ns();
+		while (test.submitted < test.depth &&
+		       test.submitted < test.total) {
+			if (submit(&test) < 0) {
+				break;
+			}
+		}
+		result = run_loop(&test, epfd, all_completed,
+				  RESPONSE_TIMEOUT_MS);
+		if (result < 0) {
+			break;
+		}
+		elapsed = now_ns() - start;
+
+		printf("%c x%u, depth %u: %u commands in %.3f s, "
+		       "%.1f commands/s, %.1f blocks/s, "
+		       "latency mean %.2f ms max %.2f ms\n",
+		       test.command, test.blocks, test.depth, test.completed,
+		       elapsed / 1e9, test.completed * 1e9 / elapsed,
+		       test.completed * test.blocks * 1e9 / elapsed,
+		       test.latency_sum_ns / 1e6 / test.completed,
+		       test.latency_max_ns / 1e6);
+	} while (0);
+
+	cr14_client_close(test.client);
+	close(epfd);
+	free(test.submit_ns);
+	if (result < 0) {
+		fprintf(stderr, "%s: %s\n", device, strerror(-result));
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,848 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * CR14 RFID Reader Driver - client library
+ *
+ * Copyright (c) 2020 Paul Guyot <pguyot@kallisys.net>
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libcr14.h"
+
+// Largest message: round summary with 255 UIDs.
+#define MAX_MESSAGE_SIZE (14 + (255 * 8))
+// Largest packet: write multiple blocks with 255 blocks.
+#define MAX_PACKET_SIZE (10 + (255 * 5))
+
+#define UID_MANUFACTURER_ST 0x02
+
+// Time to wait for the end of a message being written by the driver.
+#define PARTIAL_MESSAGE_TIMEOUT_MS 10
+
+// Queued packets are stored as <length (2 bytes)> <kind (1 byte)> <packet>.
+#define PACKET_HEADER_SIZE 3
+
+enum cr14_packet_kind {
+	packet_command,
+	packet_mode,
+	packet_other,
+};
+
+struct cr14_pending {
+	char header;
+	cr14_response_cb cb;
+	void *context;
+};
+
+struct cr14_client {
+	int fd;
+	cr14_message_cb on_message;
+	void *context;
+	// Commands without response, in order: sent ones first, then queued
+	// ones. Ring of pending_capacity (power of 2) entries.
+	struct cr14_pending *pending;
+	unsigned int pending_capacity;
+	unsigned int pending_head;
+	unsigned int pending_count;
+	unsigned int sent; // commands sent to the driver
+	// Packets waiting for the driver to have room.
+	uint8_t *queue;
+	size_t queue_len;
+	size_t queue_capacity;
+	bool dispatching; // writes are deferred while dispatching messages
+	size_t read_len; // bytes of an incomplete message in read_buffer
+	uint8_t read_buffer[MAX_MESSAGE_SIZE + CR14_READ_SIZE];
+};
+
+// ========================================================================== //
+// Messages
+// ========================================================================== //
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+	       ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+	return (uint64_t)get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+int cr14_parse_message(const uint8_t *buffer, size_t len,
+		       struct cr14_message *message)
+{
+	size_t size;
+	if (len == 0) {
+		return 0;
+	}
+	memset(message, 0, sizeof(*message));
+	message->header = (char)buffer[0];
+	switch (buffer[0]) {
+	case 'u':
+		size = 9;
+		message->uid = buffer + 1;
+		break;
+	case 'r':
+	case 'w':
+		size = 5;
+		message->count = 1;
+		message->data = buffer + 1;
+		break;
+	case 'R':
+	case 'W':
+	case 'g':
+		if (len < 2) {
+			return 0;
+		}
+		message->count = buffer[1];
+		message->data = buffer + 2;
+		size = 2 + (message->count * 4);
+		break;
+	case 'h':
+	case 'f':
+		if (len < 2) {
+			return 0;
+		}
+		message->count = buffer[1];
+		size = 2;
+		break;
+	case 'U':
+		if (len < 14) {
+			return 0;
+		}
+		message->round_id = get_le32(buffer + 1);
+		message->timestamp_ns = get_le64(buffer + 5);
+		message->count = buffer[13];
+		message->uids = buffer + 14;
+		size = 14 + (message->count * 8);
+		break;
+	default:
+		return -EPROTO;
+	}
+	if (len < size) {
+		return 0;
+	}
+	return (int)size;
+}
+
+// ========================================================================== //
+// UIDs and models
+// ========================================================================== //
+
+static const char *const model_names[] = {
+	[CR14_MODEL_UNKNOWN] = "unknown",
+	[CR14_MODEL_SRIX4K] = "SRIX4K",
+	[CR14_MODEL_SRI512] = "SRI512",
+	[CR14_MODEL_SRT512] = "SRT512",
+	[CR14_MODEL_SRI4K] = "SRI4K",
+	[CR14_MODEL_SRI2K] = "SRI2K",
+	[CR14_MODEL_ST25TB512_AC] = "ST25TB512-AC",
+	[CR14_MODEL_ST25TB04K] = "ST25TB04K",
+	[CR14_MODEL_ST25TB512_AT] = "ST25TB512-AT",
+	[CR14_MODEL_ST25TB02K] = "ST25TB02K",
+};
+
+static const uint8_t model_blocks[] = {
+	[CR14_MODEL_UNKNOWN] = 0,
+	[CR14_MODEL_SRIX4K] = 128,
+	[CR14_MODEL_SRI512] = 16,
+	[CR14_MODEL_SRT512] = 16,
+	[CR14_MODEL_SRI4K] = 128,
+	[CR14_MODEL_SRI2K] = 64,
+	[CR14_MODEL_ST25TB512_AC] = 16,
+	[CR14_MODEL_ST25TB04K] = 128,
+	[CR14_MODEL_ST25TB512_AT] = 16,
+	[CR14_MODEL_ST25TB02K] = 64,
+};
+
+void cr14_uid_reverse(const uint8_t uid[8], uint8_t reversed[8])
+{
+	uint8_t copy[8];
+	int ix;
+	memcpy(copy, uid, 8);
+	for (ix = 0; ix < 8; ix++) {
+		reversed[ix] = copy[7 - ix];
+	}
+}
+
+int cr14_uid_format(const uint8_t uid[8], char *str, size_t size)
+{
+	static const char digits[] = "0123456789abcdef";
+	int ix;
+	if (size < 17) {
+		return -ENOSPC;
+	}
+	for (ix = 0; ix < 8; ix++) {
+		str[ix * 2] = digits[uid[7 - ix] >> 4];
+		str[(ix * 2) + 1] = digits[uid[7 - ix] & 0x0F];
+	}
+	str[16] = '\0';
+	return 16;
+}
+
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+int cr14_uid_parse(const char *str, uint8_t uid[8])
+{
+	uint8_t big_endian[8];
+	int high, low;
+	int ix;
+	for (ix = 0; ix < 8; ix++) {
+		if (ix > 0 && *str == ':') {
+			str++;
+		}
+		high = hex_digit(str[0]);
+		low = high < 0 ? -1 : hex_digit(str[1]);
+		if (low < 0) {
+			return -EINVAL;
+		}
+		big_endian[ix] = (uint8_t)((high << 4) | low);
+		str += 2;
+	}
+	if (*str != '\0') {
+		return -EINVAL;
+	}
+	cr14_uid_reverse(big_endian, uid);
+	return 0;
+}
+
+// Same as the driver (see datasheets).
+enum cr14_tag_model cr14_uid_model(const uint8_t uid[8])
+{
+	if (uid[6] != UID_MANUFACTURER_ST) {
+		return CR14_MODEL_UNKNOWN;
+	}
+	// 8 bits product codes
+	switch (uid[5]) {
+	case 0x1B:
+		return CR14_MODEL_ST25TB512_AC;
+	case 0x1F:
+		return CR14_MODEL_ST25TB04K;
+	case 0x33:
+		return CR14_MODEL_ST25TB512_AT;
+	case 0x3F:
+		return CR14_MODEL_ST25TB02K;
+	}
+	// 6 bits product codes
+	switch (uid[5] >> 2) {
+	case 0x03:
+		return CR14_MODEL_SRIX4K;
+	case 0x06:
+		return CR14_MODEL_SRI512;
+	case 0x0C:
+		return CR14_MODEL_SRT512;
+	case 0x07:
+		return CR14_MODEL_SRI4K;
+	case 0x0F:
+		return CR14_MODEL_SRI2K;
+	}
+	return CR14_MODEL_UNKNOWN;
+}
+
+const char *cr14_model_name(enum cr14_tag_model model)
+{
+	if ((unsigned int)model >= sizeof(model_names) / sizeof(model_names[0])) {
+		model = CR14_MODEL_UNKNOWN;
+	}
+	return model_names[model];
+}
+
+unsigned int cr14_model_blocks(enum cr14_tag_model model)
+{
+	if ((unsigned int)model >=
+	    sizeof(model_blocks) / sizeof(model_blocks[0])) {
+		return 0;
+	}
+	return model_blocks[model];
+}
+
+// ========================================================================== //
+// Pending commands
+// ========================================================================== //
+
+static struct cr14_pending *pending_at(struct cr14_client *client,
+				       unsigned int index)
+{
+	return &client->pending[(client->pending_head + index) &
+				(client->pending_capacity - 1)];
+}
+
+static int pending_push(struct cr14_client *client, char header,
+			cr14_response_cb cb, void *context)
+{
+	struct cr14_pending *entry;
+	if (client->pending_count == client->pending_capacity) {
+		unsigned int capacity = client->pending_capacity * 2;
+		struct cr14_pending *pending;
+		unsigned int ix;
+		pending = malloc(capacity * sizeof(*pending));
+		if (!pending) {
+			return -ENOMEM;
+		}
+		for (ix = 0; ix < client->pending_count; ix++) {
+			pending[ix] = *pending_at(client, ix);
+		}
+		free(client->pending);
+		client->pending = pending;
+		client->pending_capacity = capacity;
+		client->pending_head = 0;
+	}
+	entry = pending_at(client, client->pending_count);
+	entry->header = header;
+	entry->cb = cb;
+	entry->context = context;
+	client->pending_count++;
+	return 0;
+}
+
+static struct cr14_pending pending_pop(struct cr14_client *client)
+{
+	struct cr14_pending entry = *pending_at(client, 0);
+	client->pending_head =
+		(client->pending_head + 1) & (client->pending_capacity - 1);
+	client->pending_count--;
+	return entry;
+}
+
+// Remove an entry, keeping the order of others.
+static struct cr14_pending pending_remove(struct cr14_client *client,
+					  unsigned int index)
+{
+	struct cr14_pending entry = *pending_at(client, index);
+	unsigned int ix;
+	for (ix = index; ix + 1 < client->pending_count; ix++) {
+		*pending_at(client, ix) = *pending_at(client, ix + 1);
+	}
+	client->pending_count--;
+	return entry;
+}
+
+static void pending_complete(struct cr14_client *client,
+			     struct cr14_pending *entry, int status,
+			     const struct cr14_message *message)
+{
+	if (entry->cb) {
+		entry->cb(client, status, message, entry->context);
+	}
+}
+
+// Cancel commands sent to the driver, after a mode message.
+static void cancel_sent(struct cr14_client *client)
+{
+	struct cr14_pending entry;
+	unsigned int count = client->sent;
+	client->sent = 0;
+	while (count--) {
+		entry = pending_pop(client);
+		pending_complete(client, &entry, -ECANCELED, NULL);
+	}
+}
+
+// Cancel queued commands, before queueing a mode message.
+static int cancel_queued(struct cr14_client *client)
+{
+	struct cr14_pending *cancelled;
+	unsigned int count = client->pending_count - client->sent;
+	size_t offset = 0;
+	size_t kept = 0;
+	unsigned int ix;
+	if (count == 0) {
+		return 0;
+	}
+	cancelled = malloc(count * sizeof(*cancelled));
+	if (!cancelled) {
+		return -ENOMEM;
+	}
+	for (ix = 0; ix < count; ix++) {
+		cancelled[ix] = *pending_at(client, client->sent + ix);
+	}
+	client->pending_count = client->sent;
+	// Keep packets other than commands, in order.
+	while (offset < client->queue_len) {
+		size_t size = PACKET_HEADER_SIZE + client->queue[offset] +
+			      (client->queue[offset + 1] << 8);
+		if (client->queue[offset + 2] != packet_command) {
+			memmove(client->queue + kept, client->queue + offset,
+				size);
+			kept += size;
+		}
+		offset += size;
+	}
+	client->queue_len = kept;
+	// Callbacks can queue new commands.
+	for (ix = 0; ix < count; ix++) {
+		pending_complete(client, &cancelled[ix], -ECANCELED, NULL);
+	}
+	free(cancelled);
+	return 0;
+}
+
+// ========================================================================== //
+// I/O
+// ========================================================================== //
+
+static void dispatch(struct cr14_client *client,
+		     const struct cr14_message *message)
+{
+	struct cr14_pending entry;
+	if (message->header == 'u' || message->header == 'U') {
+		if (client->on_message) {
+			client->on_message(client, message, client->context);
+		}
+		return;
+	}
+	if (client->sent == 0) {
+		// Response to a command not sent by this client object.
+		return;
+	}
+	entry = pending_pop(client);
+	client->sent--;
+	if (entry.header != message->header) {
+		pending_complete(client, &entry, -EPROTO, NULL);
+	} else {
+		pending_complete(client, &entry, 0, message);
+	}
+}
+
+// Read once and dispatch complete messages.
+static int read_messages(struct cr14_client *client)
+{
+	struct cr14_message message;
+	ssize_t result;
+	size_t offset = 0;
+	size_t len;
+	int count = 0;
+	int size;
+
+	do {
+		result = read(client->fd, client->read_buffer + client->read_len,
+			      CR14_READ_SIZE);
+	} while (result < 0 && errno == EINTR);
+	if (result < 0) {
+		return -errno;
+	}
+	len = client->read_len + (size_t)result;
+	client->dispatching = true;
+	while (offset < len) {
+		size = cr14_parse_message(client->read_buffer + offset,
+					  len - offset, &message);
+		if (size == 0) {
+			break;
+		}
+		if (size < 0) {
+			// Lost synchronization with the driver.
+			client->read_len = 0;
+			client->dispatching = false;
+			return size;
+		}
+		dispatch(client, &message);
+		offset += (size_t)size;
+		count++;
+	}
+	client->dispatching = false;
+	memmove(client->read_buffer, client->read_buffer + offset,
+		len - offset);
+	client->read_len = len - offset;
+	return count;
+}
+
+static bool wait_readable(struct cr14_client *client, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = client->fd, .events = POLLIN };
+	int result;
+	do {
+		result = poll(&pfd, 1, timeout_ms);
+	} while (result < 0 && errno == EINTR);
+	return result > 0 && (pfd.revents & POLLIN);
+}
+
+// Read responses written before a mode message. Once the write of the mode
+// message returned, no other response to previous commands is written.
+static int drain(struct cr14_client *client)
+{
+	int result;
+	while (wait_readable(client, client->read_len ?
+					     PARTIAL_MESSAGE_TIMEOUT_MS :
+					     0)) {
+		result = read_messages(client);
+		if (result < 0) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+static int write_packet(int fd, const uint8_t *packet, size_t len)
+{
+	ssize_t result;
+	// The driver consumes at most one packet per write.
+	while (len > 0) {
+		result = write(fd, packet, len);
+		if (result < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -errno;
+		}
+		packet += result;
+		len -= (size_t)result;
+	}
+	return 0;
+}
+
+int cr14_client_flush(struct cr14_client *client)
+{
+	struct cr14_pending entry;
+	size_t len;
+	uint8_t kind;
+	int result;
+
+	if (client->dispatching) {
+		// Flushed at the end of cr14_client_process().
+		return 0;
+	}
+	while (client->queue_len > 0) {
+		// The driver blocks every write while its queue is full.
+		if (client->sent >= CR14_MAX_QUEUED_COMMANDS) {
+			break;
+		}
+		len = client->queue[0] + (client->queue[1] << 8);
+		kind = client->queue[2];
+		result = write_packet(client->fd,
+				      client->queue + PACKET_HEADER_SIZE, len);
+		client->queue_len -= PACKET_HEADER_SIZE + len;
+		memmove(client->queue, client->queue + PACKET_HEADER_SIZE + len,
+			client->queue_len);
+		if (kind == packet_command) {
+			if (result < 0) {
+				// Rejected by the driver.
+				entry = pending_remove(client, client->sent);
+				pending_complete(client, &entry, result, NULL);
+				continue;
+			}
+			client->sent++;
+		} else if (result < 0) {
+			return result;
+		} else if (kind == packet_mode) {
+			result = drain(client);
+			cancel_sent(client);
+			if (result < 0) {
+				return result;
+			}
+		}
+	}
+	return 0;
+}
+
+static int queue_packet(struct cr14_client *client, const uint8_t *packet,
+			size_t len, enum cr14_packet_kind kind)
+{
+	size_t needed = client->queue_len + PACKET_HEADER_SIZE + len;
+	uint8_t *entry;
+	if (needed > client->queue_capacity) {
+		size_t capacity = client->queue_capacity * 2;
+		uint8_t *queue;
+		if (capacity < needed) {
+			capacity = needed;
+		}
+		queue = realloc(client->queue, capacity);
+		if (!queue) {
+			return -ENOMEM;
+		}
+		client->queue = queue;
+		client->queue_capacity = capacity;
+	}
+	entry = client->queue + client->queue_len;
+	entry[0] = len & 0xFF;
+	entry[1] = len >> 8;
+	entry[2] = kind;
+	memcpy(entry + PACKET_HEADER_SIZE, packet, len);
+	client->queue_len = needed;
+	return 0;
+}
+
+static int submit(struct cr14_client *client, const uint8_t *packet,
+		  size_t len, cr14_response_cb cb, void *context)
+{
+	int result;
+	result = pending_push(client, (char)packet[0], cb, context);
+	if (result < 0) {
+		return result;
+	}
+	result = queue_packet(client, packet, len, packet_command);
+	if (result < 0) {
+		pending_remove(client, client->pending_count - 1);
+		return result;
+	}
+	// Write errors are reported to the callback.
+	cr14_client_flush(client);
+	return 0;
+}
+
+static int send_message(struct cr14_client *client, const uint8_t *packet,
+			size_t len, enum cr14_packet_kind kind)
+{
+	int result;
+	if (kind == packet_mode) {
+		// They would be cancelled once written.
+		result = cancel_queued(client);
+		if (result < 0) {
+			return result;
+		}
+	}
+	result = queue_packet(client, packet, len, kind);
+	if (result < 0) {
+		return result;
+	}
+	return cr14_client_flush(client);
+}
+
+// ========================================================================== //
+// Client
+// ========================================================================== //
+
+struct cr14_client *cr14_client_open(const char *path, int flags,
+				     cr14_message_cb on_message,
+				     void *context)
+{
+	struct cr14_client *client;
+	int err;
+	client = calloc(1, sizeof(*client));
+	if (!client) {
+		return NULL;
+	}
+	client->pending_capacity = CR14_MAX_QUEUED_COMMANDS;
+	client->pending =
+		malloc(client->pending_capacity * sizeof(*client->pending));
+	client->fd = open(path, flags | O_CLOEXEC);
+	if (!client->pending || client->fd < 0) {
+		err = client->pending ? errno : ENOMEM;
+		if (client->fd >= 0) {
+			close(client->fd);
+		}
+		free(client->pending);
+		free(client);
+		errno = err;
+		return NULL;
+	}
+	client->on_message = on_message;
+	client->context = context;
+	return client;
+}
+
+void cr14_client_close(struct cr14_client *client)
+{
+	struct cr14_pending entry;
+	if (!client) {
+		return;
+	}
+	close(client->fd);
+	client->fd = -1;
+	client->queue_len = 0;
+	client->sent = 0;
+	while (client->pending_count) {
+		entry = pending_pop(client);
+		pending_complete(client, &entry, -ECANCELED, NULL);
+	}
+	free(client->queue);
+	free(client->pending);
+	free(client);
+}
+
+int cr14_client_fd(const struct cr14_client *client)
+{
+	return client->fd;
+}
+
+int cr14_client_process(struct cr14_client *client)
+{
+	int count;
+	int result;
+	count = read_messages(client);
+	result = cr14_client_flush(client);
+	if (count < 0) {
+		return count;
+	}
+	return result < 0 ? result : count;
+}
+
+bool cr14_client_wants_write(const struct cr14_client *client)
+{
+	return client->queue_len > 0;
+}
+
+unsigned int cr14_client_pending(const struct cr14_client *client)
+{
+	return client->pending_count;
+}
+
+int cr14_poll_once(struct cr14_client *client)
+{
+	static const uint8_t packet[] = { 'p' };
+	return send_message(client, packet, sizeof(packet), packet_mode);
+}
+
+int cr14_poll_repeat(struct cr14_client *client)
+{
+	static const uint8_t packet[] = { 'P' };
+	return send_message(client, packet, sizeof(packet), packet_mode);
+}
+
+int cr14_idle(struct cr14_client *client)
+{
+	static const uint8_t packet[] = { 'i' };
+	return send_message(client, packet, sizeof(packet), packet_mode);
+}
+
+int cr14_set_priority(struct cr14_client *client, uint8_t priority)
+{
+	uint8_t packet[] = { 'c', priority };
+	if (priority > 2) {
+		return -EINVAL;
+	}
+	return send_message(client, packet, sizeof(packet), packet_other);
+}
+
+int cr14_set_round_summaries(struct cr14_client *client, bool enabled)
+{
+	uint8_t packet[] = { 'U', enabled ? 1 : 0 };
+	return send_message(client, packet, sizeof(packet), packet_other);
+}
+
+// ========================================================================== //
+// Commands
+// ========================================================================== //
+
+static size_t command_header(uint8_t *packet, char header,
+			     const uint8_t uid[8])
+{
+	packet[0] = (uint8_t)header;
+	memcpy(packet + 1, uid, 8);
+	return 9;
+}
+
+static bool valid_range(uint8_t start, unsigned int count, uint8_t stride)
+{
+	unsigned int step = stride ? stride : 1;
+	return count >= 1 && count <= 255 && start + ((count - 1) * step) <= 255;
+}
+
+int cr14_read_block(struct cr14_client *client, const uint8_t uid[8],
+		    uint8_t addr, cr14_response_cb cb, void *context)
+{
+	uint8_t packet[10];
+	size_t len = command_header(packet, 'r', uid);
+	packet[len++] = addr;
+	return submit(client, packet, len, cb, context);
+}
+
+int cr14_write_block(struct cr14_client *client, const uint8_t uid[8],
+		     uint8_t addr, const uint8_t data[4], cr14_response_cb cb,
+		     void *context)
+{
+	uint8_t packet[14];
+	size_t len = command_header(packet, 'w', uid);
+	packet[len++] = addr;
+	memcpy(packet + len, data, 4);
+	return submit(client, packet, len + 4, cb, context);
+}
+
+int cr14_read_blocks(struct cr14_client *client, const uint8_t uid[8],
+		     const uint8_t *addresses, unsigned int count,
+		     cr14_response_cb cb, void *context)
+{
+	uint8_t packet[10 + 255];
+	size_t len;
+	if (count < 1 || count > 255) {
+		return -EINVAL;
+	}
+	len = command_header(packet, 'R', uid);
+	packet[len++] = (uint8_t)count;
+	memcpy(packet + len, addresses, count);
+	return submit(client, packet, len + count, cb, context);
+}
+
+int cr14_write_blocks(struct cr14_client *client, const uint8_t uid[8],
+		      const uint8_t *addresses, unsigned int count,
+		      const uint8_t *data, cr14_response_cb cb, void *context)
+{
+	uint8_t packet[MAX_PACKET_SIZE];
+	size_t len;
+	if (count < 1 || count > 255) {
+		return -EINVAL;
+	}
+	len = command_header(packet, 'W', uid);
+	packet[len++] = (uint8_t)count;
+	memcpy(packet + len, addresses, count);
+	len += count;
+	memcpy(packet + len, data, count * 4);
+	return submit(client, packet, len + (count * 4), cb, context);
+}
+
+int cr14_read_range(struct cr14_client *client, const uint8_t uid[8],
+		    uint8_t start, unsigned int count, uint8_t stride,
+		    cr14_response_cb cb, void *context)
+{
+	uint8_t packet[12];
+	size_t len;
+	if (!valid_range(start, count, stride)) {
+		return -EINVAL;
+	}
+	len = command_header(packet, 'g', uid);
+	packet[len++] = start;
+	packet[len++] = (uint8_t)count;
+	packet[len++] = stride;
+	return submit(client, packet, len, cb, context);
+}
+
+int cr14_write_range(struct cr14_client *client, const uint8_t uid[8],
+		     uint8_t start, unsigned int count, uint8_t stride,
+		     const uint8_t *data, cr14_response_cb cb, void *context)
+{
+	uint8_t packet[12 + (255 * 4)];
+	size_t len;
+	if (!valid_range(start, count, stride)) {
+		return -EINVAL;
+	}
+	len = command_header(packet, 'h', uid);
+	packet[len++] = start;
+	packet[len++] = (uint8_t)count;
+	packet[len++] = stride;
+	memcpy(packet + len, data, count * 4);
+	return submit(client, packet, len + (count * 4), cb, context);
+}
+
+int cr14_fill_range(struct cr14_client *client, const uint8_t uid[8],
+		    uint8_t start, unsigned int count, uint8_t stride,
+		    const uint8_t data[4], cr14_response_cb cb, void *context)
+{
+	uint8_t packet[16];
+	size_t len;
+	if (!valid_range(start, count, stride)) {
+		return -EINVAL;
+	}
+	len = command_header(packet, 'f', uid);
+	packet[len++] = start;
+	packet[len++] = (uint8_t)count;
+	packet[len++] = stride;
+	memcpy(packet + len, data, 4);
+	return submit(client, packet, len + 4, cb, context);
+}
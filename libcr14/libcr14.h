@@ -0,0 +1,172 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * CR14 RFID Reader Driver - client library
+ *
+ * Copyright (c) 2020 Paul Guyot <pguyot@kallisys.net>
+ */
+
+#ifndef _LIBCR14_H
+#define _LIBCR14_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cr14.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Client of /dev/rfid0, implementing the byte protocol described in cr14.c.
+//
+// Messages are parsed in place in the read buffer: pointers of a
+// struct cr14_message are only valid during the callback it is passed to.
+// The client is driven by an event loop (epoll, libuv, ...):
+// - call cr14_client_process() when cr14_client_fd() is readable;
+// - call cr14_client_flush() when it is writable, while
+//   cr14_client_wants_write() is true.
+// Reads and writes of /dev/rfid0 block (O_NONBLOCK is ignored by the driver),
+// the client only reads when the descriptor is readable and only writes
+// commands while the driver has room for them.
+//
+// Commands are pipelined: up to CR14_MAX_QUEUED_COMMANDS are sent to the
+// driver, others wait in the client. Responses of a client come in the order
+// of its commands, each calls the callback of its command.
+//
+// Mode messages (poll once, poll repeat, idle) cancel pending commands: their
+// callbacks are called with -ECANCELED.
+//
+// A client must not be closed from one of its callbacks.
+
+#define CR14_DEVICE "/dev/rfid0"
+
+// Size of the ring buffer of a client in the driver.
+#define CR14_READ_SIZE 8192
+
+struct cr14_message {
+	char header; // 'u', 'U', or header of the command
+	unsigned int count; // blocks for r, w, R, W and g, UIDs for U,
+			    // mismatching blocks for h and f
+	const uint8_t *uid; // u: little endian (8 bytes)
+	const uint8_t *data; // r, w, R, W, g: blocks data (count * 4 bytes)
+	uint32_t round_id; // U
+	uint64_t timestamp_ns; // U: CLOCK_MONOTONIC time of round start
+	const uint8_t *uids; // U: count UIDs, little endian (8 bytes each)
+};
+
+// Parse a message at the start of buffer.
+// Return the size of the message, 0 if buffer holds an incomplete message or
+// -EPROTO if the header is unknown.
+int cr14_parse_message(const uint8_t *buffer, size_t len,
+		       struct cr14_message *message);
+
+// ========================================================================== //
+// UIDs and models
+// ========================================================================== //
+
+// UIDs are little endian (LSB first), as in messages. Text UIDs are big
+// endian, as in sysfs.
+
+// Convert a little endian UID to big endian, or the reverse.
+void cr14_uid_reverse(const uint8_t uid[8], uint8_t reversed[8]);
+
+// Format a UID as 16 hexadecimal digits, as in sysfs. size must be at least
+// 17. Return the number of characters, or -ENOSPC.
+int cr14_uid_format(const uint8_t uid[8], char *str, size_t size);
+
+// Parse a UID formatted by cr14_uid_format(), optionally with colons
+// between bytes. Return 0 or -EINVAL.
+int cr14_uid_parse(const char *str, uint8_t uid[8]);
+
+enum cr14_tag_model cr14_uid_model(const uint8_t uid[8]);
+
+const char *cr14_model_name(enum cr14_tag_model model);
+
+// Number of 32 bits blocks of the memory of a model (0 if unknown).
+unsigned int cr14_model_blocks(enum cr14_tag_model model);
+
+// ========================================================================== //
+// Client
+// ========================================================================== //
+
+struct cr14_client;
+
+// UID messages and round summaries.
+typedef void (*cr14_message_cb)(struct cr14_client *client,
+				const struct cr14_message *message,
+				void *context);
+
+// Response of a command: status is 0 and message the response, or status is
+// -ECANCELED or -EPROTO (response does not match command) and message NULL.
+typedef void (*cr14_response_cb)(struct cr14_client *client, int status,
+				 const struct cr14_message *message,
+				 void *context);
+
+// Open a client, read-only (polling repeatedly) if flags is O_RDONLY, or
+// read-write (idle) if flags is O_RDWR. Return NULL and set errno on error.
+struct cr14_client *cr14_client_open(const char *path, int flags,
+				     cr14_message_cb on_message,
+				     void *context);
+
+// Close a client. Callbacks of pending commands are called with -ECANCELED.
+void cr14_client_close(struct cr14_client *client);
+
+int cr14_client_fd(const struct cr14_client *client);
+
+// Read and dispatch available messages. Call when the descriptor is
+// readable, as read blocks otherwise. Return the number of messages or a
+// negative errno.
+int cr14_client_process(struct cr14_client *client);
+
+// Write queued packets while the driver has room. Return 0 or a negative
+// errno.
+int cr14_client_flush(struct cr14_client *client);
+
+// Whether packets wait for the driver to have room, i.e. whether the event
+// loop should wait for the descriptor to be writable.
+bool cr14_client_wants_write(const struct cr14_client *client);
+
+// Commands without response yet.
+unsigned int cr14_client_pending(const struct cr14_client *client);
+
+// Modes, cancelling pending commands.
+int cr14_poll_once(struct cr14_client *client);
+int cr14_poll_repeat(struct cr14_client *client);
+int cr14_idle(struct cr14_client *client);
+
+// Priority class of subsequent commands and polling:
+// 0 = realtime, 1 = interactive, 2 = background.
+int cr14_set_priority(struct cr14_client *client, uint8_t priority);
+
+// Get round summaries instead of UID messages.
+int cr14_set_round_summaries(struct cr14_client *client, bool enabled);
+
+// Commands. Return 0 once queued, -EINVAL if arguments are invalid, or
+// -ENOMEM.
+int cr14_read_block(struct cr14_client *client, const uint8_t uid[8],
+		    uint8_t addr, cr14_response_cb cb, void *context);
+int cr14_write_block(struct cr14_client *client, const uint8_t uid[8],
+		     uint8_t addr, const uint8_t data[4], cr14_response_cb cb,
+		     void *context);
+int cr14_read_blocks(struct cr14_client *client, const uint8_t uid[8],
+		     const uint8_t *addresses, unsigned int count,
+		     cr14_response_cb cb, void *context);
+int cr14_write_blocks(struct cr14_client *client, const uint8_t uid[8],
+		      const uint8_t *addresses, unsigned int count,
+		      const uint8_t *data, cr14_response_cb cb, void *context);
+int cr14_read_range(struct cr14_client *client, const uint8_t uid[8],
+		    uint8_t start, unsigned int count, uint8_t stride,
+		    cr14_response_cb cb, void *context);
+int cr14_write_range(struct cr14_client *client, const uint8_t uid[8],
+		     uint8_t start, unsigned int count, uint8_t stride,
+		     const uint8_t *data, cr14_response_cb cb, void *context);
+int cr14_fill_range(struct cr14_client *client, const uint8_t uid[8],
+		    uint8_t start, unsigned int count, uint8_t stride,
+		    const uint8_t data[4], cr14_response_cb cb, void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,25 @@
+"""Client of the CR14 RFID reader driver (/dev/rfid0)."""
+
+from .aio import AsyncReader
+from .client import DEVICE, CommandCancelled, Reader
+from .protocol import (
+    PRIORITY_BACKGROUND,
+    PRIORITY_INTERACTIVE,
+    PRIORITY_REALTIME,
+    ProtocolError,
+    RoundSummary,
+)
+from .uid import Uid
+
+__all__ = [
+    "DEVICE",
+    "AsyncReader",
+    "CommandCancelled",
+    "PRIORITY_BACKGROUND",
+    "PRIORITY_INTERACTIVE",
+    "PRIORITY_REALTIME",
+    "ProtocolError",
+    "Reader",
+    "RoundSummary",
+    "Uid",
+]
@@ -0,0 +1,200 @@
+"""asyncio client of /dev/rfid0."""
+
+import asyncio
+import collections
+import os
+import select
+
+from . import protocol
+from .client import DEVICE, CommandCancelled, Core
+
+
+class AsyncReader:
+    """Client of the reader for asyncio, with a transport on top of poll.
+
+    The device is read in large chunks when the event loop reports it
+    readable. Commands return asyncio futures. Packets are written when the
+    driver has room for a new command, without blocking the loop. Commands
+    still waiting to be written when a mode message is sent are not written
+    and their futures fail.
+    """
+
+    def __init__(self, path=DEVICE, read_only=False):
+        self._loop = asyncio.get_running_loop()
+        self.fd = os.open(path, os.O_RDONLY if read_only else os.O_RDWR)
+        self.core = Core()
+        self._messages = asyncio.Queue()
+        # Packets to write, with the future of commands (None otherwise).
+        self._writes = collections.deque()
+        self._writer = False
+        self._poller = select.poll()
+        self._poller.register(self.fd, select.POLLIN | select.POLLOUT)
+        self._loop.add_reader(self.fd, self._on_readable)
+
+    def close(self):
+        """Close the device, cancelling commands and polling."""
+        if self.fd < 0:
+            return
+        self._loop.remove_reader(self.fd)
+        if self._writer:
+            self._loop.remove_writer(self.fd)
+        os.close(self.fd)
+        self.fd = -1
+        self._cancel_queued()
+        self._writes.clear()
+        self.core.cancel_pending()
+
+    async def __aenter__(self):
+        return self
+
+    async def __aexit__(self, *exc_info):
+        self.close()
+
+    def _ready(self, event):
+        return any(mask & event for _, mask in self._poller.poll(0))
+
+    def _on_readable(self):
+        # Reads block on an empty device: data may have been read since
+        # the loop polled.
+        if not self._ready(select.POLLIN):
+            return
+        chunk = os.read(self.fd, protocol.READ_SIZE)
+        for message in self.core.feed(chunk):
+            self._messages.put_nowait(message)
+
+    def _flush(self):
+        while self._writes and self._ready(select.POLLOUT):
+            packet, future = self._writes.popleft()
+            if future is None:
+                os.write(self.fd, packet)
+                if packet in protocol.MODE_MESSAGES:
+                    self._after_mode()
+                continue
+            # Only commands written to the driver get a response or are
+            # cancelled by the next mode message.
+            self.core.expect(packet, future)
+            try:
+                os.write(self.fd, packet)
+            except OSError as error:
+                # Rejected by the driver.
+                self.core.pending.pop()
+                if not future.done():
+                    future.set_exception(error)
+        writer = bool(self._writes)
+        if writer and not self._writer:
+            self._loop.add_writer(self.fd, self._flush)
+        elif self._writer and not writer:
+            self._loop.remove_writer(self.fd)
+        self._writer = writer
+
+    def _after_mode(self):
+        # Responses to commands written before were written before the write
+        # returned: read them, then fail futures of the other (cancelled)
+        # commands.
+        while self._ready(select.POLLIN) or (
+            self.core.parser.partial and self._wait_readable()
+        ):
+            self._on_readable()
+        self.core.cancel_pending()
+
+    def _wait_readable(self):
+        # Rest of a message being written.
+        return bool(self._poller.poll(10))
+
+    def _cancel_queued(self):
+        # Commands not written yet: keep other packets, in order.
+        kept = collections.deque()
+        for packet, future in self._writes:
+            if future is None:
+                kept.append((packet, None))
+            elif not future.done():
+                future.set_exception(CommandCancelled())
+        self._writes = kept
+
+    def _write(self, packet, future=None):
+        if packet in protocol.MODE_MESSAGES:
+            # They would be cancelled once written.
+            self._cancel_queued()
+        self._writes.append((packet, future))
+        self._flush()
+
+    async def message(self):
+        """Wait for the next UID message or round summary."""
+        return await self._messages.get()
+
+    def __aiter__(self):
+        return self
+
+    async def __anext__(self):
+        return await self.message()
+
+    def poll_once(self):
+        """Poll until a chip is found, cancelling pending commands."""
+        self._write(protocol.POLL_ONCE)
+
+    def poll_repeat(self):
+        """Poll repeatedly, cancelling pending commands."""
+        self._write(protocol.POLL_REPEAT)
+
+    def idle(self):
+        """Stop polling, cancelling pending commands."""
+        self._write(protocol.IDLE)
+
+    def set_priority(self, priority):
+        """Set priority class of subsequent commands and polling."""
+        self._write(protocol.priority_class(priority))
+
+    def set_round_summaries(self, enabled):
+        """Get RoundSummary messages instead of UIDs."""
+        self._write(protocol.round_summaries(enabled))
+
+    def submit(self, packet):
+        """Queue a command packet and return the future of its response."""
+        future = self._loop.create_future()
+        self._write(packet, future)
+        return future
+
+    async def wait_uid(self):
+        """Poll once and return the UID of the first chip found.
+
+        Messages queued before are discarded.
+        """
+        self.poll_once()
+        while not self._messages.empty():
+            self._messages.get_nowait()
+        while True:
+            message = await self.message()
+            if isinstance(message, protocol.Uid):
+                return message
+
+    async def read_block(self, uid, addr):
+        """Read a block, return its data (4 bytes)."""
+        return await self.submit(protocol.read_block(uid, addr))
+
+    async def write_block(self, uid, addr, data):
+        """Write a block, return data read back."""
+        return await self.submit(protocol.write_block(uid, addr, data))
+
+    async def read_blocks(self, uid, addresses):
+        """Read blocks, return the list of their data."""
+        return await self.submit(protocol.read_blocks(uid, addresses))
+
+    async def write_blocks(self, uid, addresses, data):
+        """Write blocks, return the list of data read back."""
+        packet = protocol.write_blocks(uid, addresses, data)
+        return await self.submit(packet)
+
+    async def read_range(self, uid, start, count, stride=1):
+        """Read a range of blocks, return the list of their data."""
+        packet = protocol.read_range(uid, start, count, stride)
+        return await self.submit(packet)
+
+    async def write_range(self, uid, start, data, stride=1):
+        """Write a range of blocks, return number of mismatching blocks."""
+        packet = protocol.write_range(uid, start, data, stride)
+        return await self.submit(packet)
+
+    async def fill_range(self, uid, start, count, data, stride=1):
+        """Fill a range of blocks, return number of mismatching blocks."""
+        packet = protocol.fill_range(uid, start, count, data, stride)
+        return await self.submit(packet)
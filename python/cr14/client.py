@@ -0,0 +1,233 @@
+"""Blocking client of /dev/rfid0, with futures for command responses."""
+
+import collections
+import concurrent.futures
+import os
+import select
+import time
+
+from . import protocol
+
+DEVICE = "/dev/rfid0"
+
+
+class CommandCancelled(Exception):
+    """Raised by futures of commands cancelled by a mode message."""
+
+
+class Core:
+    """Correlate responses with commands, independently of I/O.
+
+    A client's commands complete in the order they were sent, so each
+    response completes the oldest pending command. Futures are completed
+    with set_result() and set_exception(), as concurrent.futures and asyncio
+    futures.
+    """
+
+    def __init__(self):
+        self.parser = protocol.Parser()
+        self.pending = collections.deque()
+
+    def expect(self, packet, future):
+        """Register the future of a command packet about to be written."""
+        self.pending.append((packet[0], future))
+
+    def feed(self, chunk):
+        """Parse a chunk, complete futures and return other messages."""
+        events = []
+        for message in self.parser.feed(chunk):
+            if not isinstance(message, protocol.Response):
+                events.append(message)
+                continue
+            if not self.pending:
+                # Response to a command not sent by this object.
+                continue
+            header, future = self.pending.popleft()
+            if future.done():
+                # Cancelled by the application.
+                continue
+            if header != message.header:
+                future.set_exception(
+                    protocol.ProtocolError(
+                        f"Got response {chr(message.header)!r} to"
+                        f" command {chr(header)!r}"
+                    )
+                )
+            else:
+                future.set_result(message.value)
+        return events
+
+    def cancel_pending(self):
+        """Fail futures of commands cancelled by a mode message."""
+        while self.pending:
+            _, future = self.pending.popleft()
+            if not future.done():
+                future.set_exception(CommandCancelled())
+
+
+class Reader:
+    """Client of the reader, reading messages in large chunks.
+
+    UID messages and round summaries are returned by messages() or passed
+    to on_message if set. Commands return futures completed by
+    process(), which messages() and wait() call.
+    """
+
+    def __init__(self, path=DEVICE, read_only=False, on_message=None):
+        self.fd = os.open(path, os.O_RDONLY if read_only else os.O_RDWR)
+        self.core = Core()
+        self.on_message = on_message
+        self._events = collections.deque()
+        self._poller = select.poll()
+        self._poller.register(self.fd, select.POLLIN)
+
+    def fileno(self):
+        """File descriptor, to poll for select.POLLIN in an event loop."""
+        return self.fd
+
+    def close(self):
+        """Close the device, cancelling commands and polling."""
+        if self.fd >= 0:
+            os.close(self.fd)
+            self.fd = -1
+            self.core.cancel_pending()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc_info):
+        self.close()
+
+    def process(self, timeout=0):
+        """Read available messages, waiting at most timeout seconds.
+
+        Complete futures of commands and queue other messages or pass them
+        to on_message. timeout None waits for data. Return whether data was
+        read.
+        """
+        wait_ms = None if timeout is None else int(timeout * 1000)
+        if not self._poller.poll(wait_ms):
+            return False
+        # Device is readable: read does not block and returns every
+        # available byte.
+        events = self.core.feed(os.read(self.fd, protocol.READ_SIZE))
+        if self.on_message:
+            for event in events:
+                self.on_message(event)
+        else:
+            self._events.extend(events)
+        return True
+
+    def messages(self, timeout=None):
+        """Iterate on UID messages and round summaries.
+
+        Stop after timeout seconds without data (never if None).
+        """
+        while True:
+            while self._events:
+                yield self._events.popleft()
+            if not self.process(timeout) and timeout is not None:
+                return
+
+    def _mode(self, message):
+        os.write(self.fd, message)
+        # Responses to commands sent before were written before the write
+        # returned: read them, including the rest of a message being
+        # written, then fail futures of the other (cancelled) commands.
+        while self.process(0.01 if self.core.parser.partial else 0):
+            pass
+        self.core.cancel_pending()
+
+    def poll_once(self):
+        """Poll until a chip is found, cancelling pending commands."""
+        self._mode(protocol.POLL_ONCE)
+
+    def poll_repeat(self):
+        """Poll repeatedly, cancelling pending commands."""
+        self._mode(protocol.POLL_REPEAT)
+
+    def idle(self):
+        """Stop polling, cancelling pending commands."""
+        self._mode(protocol.IDLE)
+
+    def set_priority(self, priority):
+        """Set priority class of subsequent commands and polling."""
+        os.write(self.fd, protocol.priority_class(priority))
+
+    def set_round_summaries(self, enabled):
+        """Get RoundSummary messages instead of UIDs."""
+        os.write(self.fd, protocol.round_summaries(enabled))
+
+    def submit(self, packet):
+        """Write a command packet and return the future of its response.
+
+        Commands can be pipelined: the driver queues up to 16 commands per
+        client and write blocks when the queue is full.
+        """
+        future = concurrent.futures.Future()
+        self.core.expect(packet, future)
+        try:
+            os.write(self.fd, packet)
+        except OSError:
+            self.core.pending.pop()
+            raise
+        return future
+
+    def wait(self, future, timeout=None):
+        """Process messages until future is done, return its result."""
+        deadline = None if timeout is None else time.monotonic() + timeout
+        while not future.done():
+            remaining = None
+            if deadline is not None:
+                remaining = deadline - time.monotonic()
+                if remaining <= 0:
+                    raise TimeoutError("No response from reader")
+            self.process(remaining)
+        return future.result()
+
+    def wait_uid(self, timeout=None):
+        """Poll once and return the UID of the first chip found.
+
+        Messages queued before are discarded.
+        """
+        self.poll_once()
+        self._events.clear()
+        for message in self.messages(timeout):
+            if isinstance(message, protocol.Uid):
+                return message
+        raise TimeoutError("No chip found")
+
+    def read_block(self, uid, addr, timeout=None):
+        """Read a block, return its data (4 bytes)."""
+        future = self.submit(protocol.read_block(uid, addr))
+        return self.wait(future, timeout)
+
+    def write_block(self, uid, addr, data, timeout=None):
+        """Write a block, return data read back."""
+        future = self.submit(protocol.write_block(uid, addr, data))
+        return self.wait(future, timeout)
+
+    def read_blocks(self, uid, addresses, timeout=None):
+        """Read blocks, return the list of their data."""
+        future = self.submit(protocol.read_blocks(uid, addresses))
+        return self.wait(future, timeout)
+
+    def write_blocks(self, uid, addresses, data, timeout=None):
+        """Write blocks, return the list of data read back."""
+        future = self.submit(protocol.write_blocks(uid, addresses, data))
+        return self.wait(future, timeout)
+
+    def read_range(self, uid, start, count, stride=1, timeout=None):
+        """Read a range of blocks, return the list of their data."""
+        future = self.submit(protocol.read_range(uid, start, count, stride))
+        return self.wait(future, timeout)
+
+    def write_range(self, uid, start, data, stride=1, timeout=None):
+        """Write a range of blocks, return number of mismatching blocks."""
+        future = self.submit(protocol.write_range(uid, start, data, stride))
+        return self.wait(future, timeout)
+
+    def fill_range(self, uid, start, count, data, stride=1, timeout=None):
+        """Fill a range of blocks, return number of mismatching blocks."""
+        packet = protocol.fill_range(uid, start, count, data, stride)
+        return self.wait(self.submit(packet), timeout)
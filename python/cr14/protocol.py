@@ -0,0 +1,225 @@
+"""Byte protocol of /dev/rfid0 (see PROTOCOL in cr14.c).
+
+Messages are reassembled by Parser from arbitrary chunks read from the
+device. Commands are encoded by the functions of this module.
+"""
+
+import collections
+import struct
+
+from .uid import Uid
+
+# Client => driver
+POLL_ONCE = b"p"
+POLL_REPEAT = b"P"
+IDLE = b"i"
+MODE_MESSAGES = (POLL_ONCE, POLL_REPEAT, IDLE)
+
+# Driver => client, and headers of commands with a response.
+UID = ord("u")
+READ_SINGLE_BLOCK = ord("r")
+WRITE_SINGLE_BLOCK = ord("w")
+READ_MULTIPLE_BLOCKS = ord("R")
+WRITE_MULTIPLE_BLOCKS = ord("W")
+READ_RANGE = ord("g")
+WRITE_RANGE = ord("h")
+FILL_RANGE = ord("f")
+PRIORITY_CLASS = ord("c")
+ROUND_SUMMARY = ord("U")
+
+RESPONSE_HEADERS = frozenset(b"rwRWghf")
+
+PRIORITY_REALTIME = 0
+PRIORITY_INTERACTIVE = 1
+PRIORITY_BACKGROUND = 2
+
+# Size of the ring buffer of each client in the driver: a read of this size
+# gets every available message.
+READ_SIZE = 8192
+
+_SUMMARY = struct.Struct("<IQB")
+
+RoundSummary = collections.namedtuple(
+    "RoundSummary", ("round_id", "timestamp_ns", "uids")
+)
+RoundSummary.__doc__ = """Chips found during an inventory round.
+
+timestamp_ns is CLOCK_MONOTONIC time of the start of the round.
+"""
+
+Response = collections.namedtuple("Response", ("header", "value"))
+Response.__doc__ = """Response to a command.
+
+value is the data of the block (4 bytes) for r and w, the list of data of
+each block for R, W and g, and the number of mismatching blocks for h and f.
+"""
+
+
+class ProtocolError(Exception):
+    """Raised on an unknown message header."""
+
+
+def _blocks(data, start, count):
+    return [data[start + 4 * ix : start + 4 * ix + 4] for ix in range(count)]
+
+
+class Parser:
+    """Reassemble messages from chunks read from the device.
+
+    feed() parses every complete message of a chunk in one pass and keeps
+    the incomplete tail for the next chunk. Messages are Uid, RoundSummary
+    and Response objects.
+    """
+
+    def __init__(self):
+        self._pending = b""
+
+    @property
+    def partial(self):
+        """Whether an incomplete message is waiting for more bytes."""
+        return bool(self._pending)
+
+    def feed(self, chunk):
+        """Parse a chunk and return the list of complete messages."""
+        data = self._pending + chunk if self._pending else bytes(chunk)
+        messages = []
+        offset = 0
+        end = len(data)
+        while offset < end:
+            header = data[offset]
+            if header == UID:
+                if end - offset < 9:
+                    break
+                messages.append(Uid(data[offset + 1 : offset + 9]))
+                offset += 9
+            elif header in (READ_SINGLE_BLOCK, WRITE_SINGLE_BLOCK):
+                if end - offset < 5:
+                    break
+                value = data[offset + 1 : offset + 5]
+                messages.append(Response(header, value))
+                offset += 5
+            elif header in (
+                READ_MULTIPLE_BLOCKS,
+                WRITE_MULTIPLE_BLOCKS,
+                READ_RANGE,
+            ):
+                if end - offset < 2:
+                    break
+                count = data[offset + 1]
+                length = 2 + 4 * count
+                if end - offset < length:
+                    break
+                value = _blocks(data, offset + 2, count)
+                messages.append(Response(header, value))
+                offset += length
+            elif header in (WRITE_RANGE, FILL_RANGE):
+                if end - offset < 2:
+                    break
+                messages.append(Response(header, data[offset + 1]))
+                offset += 2
+            elif header == ROUND_SUMMARY:
+                if end - offset < 1 + _SUMMARY.size:
+                    break
+                round_id, timestamp, count = _SUMMARY.unpack_from(
+                    data, offset + 1
+                )
+                length = 1 + _SUMMARY.size + 8 * count
+                if end - offset < length:
+                    break
+                start = offset + 1 + _SUMMARY.size
+                uids = [
+                    Uid(data[start + 8 * ix : start + 8 * ix + 8])
+                    for ix in range(count)
+                ]
+                messages.append(RoundSummary(round_id, timestamp, uids))
+                offset += length
+            else:
+                self._pending = b""
+                raise ProtocolError(f"Unknown message header {header:#x}")
+        self._pending = data[offset:]
+        return messages
+
+
+def _uid(uid):
+    if not isinstance(uid, Uid):
+        uid = Uid(uid)
+    return uid
+
+
+def _addresses(addresses):
+    addresses = bytes(addresses)
+    if not 1 <= len(addresses) <= 255:
+        raise ValueError("Commands address 1 to 255 blocks")
+    return addresses
+
+
+def _data(data, count):
+    data = b"".join(data) if not isinstance(data, bytes) else data
+    if len(data) != 4 * count:
+        raise ValueError("Blocks are 4 bytes long")
+    return data
+
+
+def read_block(uid, addr):
+    """Read single block command."""
+    return b"r" + _uid(uid) + bytes((addr,))
+
+
+def write_block(uid, addr, data):
+    """Write single block command. Response is the data read back."""
+    return b"w" + _uid(uid) + bytes((addr,)) + _data(data, 1)
+
+
+def read_blocks(uid, addresses):
+    """Read multiple blocks command."""
+    addresses = _addresses(addresses)
+    return b"R" + _uid(uid) + bytes((len(addresses),)) + addresses
+
+
+def write_blocks(uid, addresses, data):
+    """Write multiple blocks command, data being bytes or a list of blocks.
+
+    Response is the data read back.
+    """
+    addresses = _addresses(addresses)
+    return (
+        b"W"
+        + _uid(uid)
+        + bytes((len(addresses),))
+        + addresses
+        + _data(data, len(addresses))
+    )
+
+
+def _range(header, uid, start, count, stride):
+    if not 1 <= count <= 255 or start + (count - 1) * max(stride, 1) > 255:
+        raise ValueError("Range exceeds block 255")
+    return header + _uid(uid) + bytes((start, count, stride))
+
+
+def read_range(uid, start, count, stride=1):
+    """Read range command."""
+    return _range(b"g", uid, start, count, stride)
+
+
+def write_range(uid, start, data, stride=1):
+    """Write range command. Response is the number of mismatching blocks."""
+    if not isinstance(data, bytes):
+        data = b"".join(data)
+    count = len(data) // 4
+    return _range(b"h", uid, start, count, stride) + _data(data, count)
+
+
+def fill_range(uid, start, count, data, stride=1):
+    """Fill range command. Response is the number of mismatching blocks."""
+    return _range(b"f", uid, start, count, stride) + _data(data, 1)
+
+
+def priority_class(priority):
+    """Priority class message, for subsequent commands and polling."""
+    return b"c" + bytes((priority,))
+
+
+def round_summaries(enabled):
+    """Round summary message, enabling or disabling summaries."""
+    return b"U" + bytes((1 if enabled else 0,))
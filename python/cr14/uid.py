@@ -0,0 +1,131 @@
+"""UIDs of SR chips, with their manufacturer and model."""
+
+# Model bits and values of each manufacturer, see datasheets.
+MODELS = {
+    0x02: (
+        # http://www.orangetags.com/wp-content/downloads/datasheet/STM/srix4k.pdf
+        (6, 0b000011, "SRIX4K"),
+        # http://www.advanide.com/wp-content/uploads/products/rfid/SRI512.pdf
+        (6, 0b000110, "SRI512"),
+        # https://www.advanide.de/wp-content/uploads/products/rfid/SRT512.pdf
+        (6, 0b001100, "SRT512"),
+        # https://www.advanide.de/wp-content/uploads/products/rfid/SRI4K.pdf
+        (6, 0b000111, "SRI4K"),
+        # https://www.advanide.de/wp-content/uploads/products/rfid/SRI2K.pdf
+        (6, 0b001111, "SRI2K"),
+        # https://www.st.com/resource/en/datasheet/st25tb512-ac.pdf
+        (8, 0x1B, "ST25TB512-AC"),
+        # https://www.st.com/resource/en/datasheet/st25tb04k.pdf
+        (8, 0x1F, "ST25TB04K"),
+        # https://www.st.com/resource/en/datasheet/st25tb512-at.pdf
+        (8, 0x33, "ST25TB512-AT"),
+        # https://www.st.com/resource/en/datasheet/st25tb02k.pdf
+        (8, 0x3F, "ST25TB02K"),
+    )
+}
+
+MANUFACTURERS = {
+    0x01: "Motorola",
+    0x02: "ST Microelectronics",
+    0x03: "Hitachi",
+    0x04: "NXP Semiconductors",
+    0x05: "Infineon Technologies",
+    0x06: "Cylinc",
+    0x07: "Texas Instruments Tag-it",
+    0x08: "Fujitsu Limited",
+    0x09: "Matsushita Electric Industrial",
+    0x0A: "NEC",
+    0x0B: "Oki Electric",
+    0x0C: "Toshiba",
+    0x0D: "Mitsubishi Electric",
+    0x0E: "Samsung Electronics",
+    0x0F: "Hyundai Electronics",
+    0x10: "LG Semiconductors",
+    0x16: "EM Microelectronic-Marin",
+    0x1F: "Melexis",
+    0x2B: "Maxim",
+    0x33: "AMIC",
+    0x44: "GenTag, Inc (USA)",
+    0x45: "Invengo Information Technology Co.Ltd",
+}
+
+UID_MSB = 0xD0
+
+
+class Uid(bytes):
+    """UID of a chip, as sent by the driver (8 bytes, little endian).
+
+    str() and hex() use big endian, as printed on chips and in sysfs.
+    """
+
+    __slots__ = ()
+
+    def __new__(cls, little_endian):
+        if len(little_endian) != 8:
+            raise ValueError("UIDs are 8 bytes long")
+        return super().__new__(cls, little_endian)
+
+    @classmethod
+    def from_big_endian(cls, big_endian):
+        """Build a UID from its big endian bytes."""
+        return cls(bytes(reversed(big_endian)))
+
+    @classmethod
+    def from_str(cls, text):
+        """Parse a big endian UID such as d0:02:1a:... or d0021a..."""
+        return cls.from_big_endian(bytes.fromhex(text.replace(":", "")))
+
+    @property
+    def big_endian(self):
+        """UID bytes, most significant byte first."""
+        return bytes(reversed(self))
+
+    def __str__(self):
+        return ":".join(f"{byte:02x}" for byte in self.big_endian)
+
+    def __repr__(self):
+        return f"Uid.from_str('{self}')"
+
+    def hex(self, *args):
+        """Big endian hexadecimal string, as used in sysfs."""
+        return self.big_endian.hex(*args)
+
+    @property
+    def manufacturer_code(self):
+        """Manufacturer code (byte 6)."""
+        return self[6]
+
+    @property
+    def manufacturer(self):
+        """Manufacturer name, or None if unknown."""
+        return MANUFACTURERS.get(self[6])
+
+    def _model(self):
+        # 8 bits product codes first, as the driver does.
+        models = sorted(MODELS.get(self[6], ()), key=lambda m: -m[0])
+        for bits, model_id, name in models:
+            if self[5] >> (8 - bits) == model_id:
+                return bits, name
+        return None, None
+
+    @property
+    def model(self):
+        """Model name, or None if unknown."""
+        return self._model()[1]
+
+    @property
+    def serial(self):
+        """Serial number: bytes following manufacturer and model bits."""
+        bits, _ = self._model()
+        big_endian = bytearray(self.big_endian)
+        if bits is None:
+            return bytes(big_endian[2:])
+        if bits == 8:
+            return bytes(big_endian[3:])
+        big_endian[2] &= (1 << (8 - bits)) - 1
+        return bytes(big_endian[2:])
+
+    @property
+    def valid(self):
+        """Whether most significant byte is the expected 0xD0."""
+        return self[7] == UID_MSB